@@ -0,0 +1,162 @@
+// Débit de l'anneau de FTPStream entre un producteur et un consommateur sur deux threads,
+// comparé à la classe précédente. Chaque variante reproduit l'usage qu'en fait FTPStream :
+//   legacy+mutex : recv() dans un tampon intermédiaire puis write() sous verrou, read()
+//                  sous verrou vers un autre tampon puis envoi (quatre copies)
+//   spsc copy    : mêmes copies, sans verrou
+//   spsc span    : recv() directement dans le span d'écriture, envoi depuis le span de
+//                  lecture (deux copies)
+// recv() et l'envoi sont remplacés par un memcpy depuis ou vers un tampon de 64 Ko.
+
+#include "circular_buffer.h"
+#include "legacy_circular_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using esphome::ftp_http_proxy::CircularBuffer;
+using bench::LegacyCircularBuffer;
+
+namespace {
+
+static const size_t RING_SIZE = 64 * 1024;  // FTPStream::RING_SIZE
+static const size_t IO_SIZE = 64 * 1024;
+
+struct Endpoints {
+  std::vector<uint8_t> source = std::vector<uint8_t>(IO_SIZE, 0x5a);
+  std::vector<uint8_t> sink = std::vector<uint8_t>(IO_SIZE);
+};
+
+// Lance producer et consumer sur deux threads et retourne le débit en Go/s
+template<typename Producer, typename Consumer> double measure(uint64_t total, Producer producer, Consumer consumer) {
+  auto start = std::chrono::steady_clock::now();
+  std::thread thread([&]() {
+    for (uint64_t produced = 0; produced < total;) {
+      size_t count = producer(std::min<uint64_t>(total - produced, IO_SIZE));
+      if (count == 0) {
+        std::this_thread::yield();
+      }
+      produced += count;
+    }
+  });
+  for (uint64_t consumed = 0; consumed < total;) {
+    size_t count = consumer();
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+    consumed += count;
+  }
+  thread.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return total / seconds / 1e9;
+}
+
+double run_legacy(uint64_t total, size_t chunk) {
+  LegacyCircularBuffer ring(RING_SIZE);
+  std::mutex lock;
+  Endpoints io;
+  std::vector<uint8_t> recv_scratch(chunk);
+  std::vector<uint8_t> send_scratch(chunk);
+  return measure(
+      total,
+      [&](uint64_t remaining) {
+        size_t count = std::min<uint64_t>(remaining, chunk);
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          count = std::min(count, ring.available_for_write());
+        }
+        if (count == 0) {
+          return size_t(0);
+        }
+        memcpy(recv_scratch.data(), io.source.data(), count);
+        std::lock_guard<std::mutex> guard(lock);
+        return ring.write(recv_scratch.data(), count);
+      },
+      [&]() {
+        size_t count;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          count = ring.read(send_scratch.data(), chunk);
+        }
+        memcpy(io.sink.data(), send_scratch.data(), count);
+        return count;
+      });
+}
+
+double run_copy(uint64_t total, size_t chunk) {
+  CircularBuffer ring(RING_SIZE);
+  Endpoints io;
+  std::vector<uint8_t> recv_scratch(chunk);
+  std::vector<uint8_t> send_scratch(chunk);
+  return measure(
+      total,
+      [&](uint64_t remaining) {
+        size_t count = std::min<uint64_t>({remaining, chunk, ring.available_for_write()});
+        if (count == 0) {
+          return size_t(0);
+        }
+        memcpy(recv_scratch.data(), io.source.data(), count);
+        return ring.write(recv_scratch.data(), count);
+      },
+      [&]() {
+        size_t count = ring.read(send_scratch.data(), chunk);
+        memcpy(io.sink.data(), send_scratch.data(), count);
+        return count;
+      });
+}
+
+double run_span(uint64_t total, size_t chunk) {
+  CircularBuffer ring(RING_SIZE);
+  Endpoints io;
+  return measure(
+      total,
+      [&](uint64_t remaining) {
+        CircularBuffer::Span span = ring.acquire_write_span();
+        size_t count = std::min<uint64_t>({remaining, chunk, span.size});
+        memcpy(span.data, io.source.data(), count);
+        ring.commit(count);
+        return count;
+      },
+      [&]() {
+        CircularBuffer::Span span = ring.acquire_read_span();
+        size_t count = std::min(span.size, chunk);
+        memcpy(io.sink.data(), span.data, count);
+        ring.release(count);
+        return count;
+      });
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  // Volume par mesure, en Mo
+  uint64_t total = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024) << 20;
+  static const size_t CHUNKS[] = {536, 1460, 4096, 16384};
+  static const struct {
+    const char *name;
+    double (*run)(uint64_t, size_t);
+  } VARIANTS[] = {
+      {"legacy+mutex", run_legacy},
+      {"spsc copy", run_copy},
+      {"spsc span", run_span},
+  };
+  printf("%-13s", "chunk");
+  for (size_t chunk : CHUNKS) {
+    printf("%10zu", chunk);
+  }
+  printf("   (GB/s, %llu MB through a %zu KB ring)\n", (unsigned long long) (total >> 20), RING_SIZE / 1024);
+  for (const auto &variant : VARIANTS) {
+    printf("%-13s", variant.name);
+    for (size_t chunk : CHUNKS) {
+      printf("%10.2f", variant.run(total, chunk));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,196 @@
+// Tests host de ftp_http_proxy::CircularBuffer : cas limites de l'API à copie et des
+// spans, puis un producteur et un consommateur sur deux threads qui font passer un flux
+// vérifiable par un petit anneau. À compiler aussi avec -fsanitize=thread.
+
+#include "circular_buffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+using esphome::ftp_http_proxy::CircularBuffer;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+// Octet attendu à la position position du flux
+uint8_t stream_byte(uint64_t position) { return static_cast<uint8_t>(position * 7 + (position >> 8)); }
+
+void test_capacity() {
+  CircularBuffer buffer(1024);
+  CHECK(buffer.valid());
+  CHECK(buffer.capacity() == 1024);
+  CHECK(buffer.isEmpty());
+  CHECK(!buffer.isFull());
+  CHECK(buffer.freeSpace() == 1024);
+
+  // La capacité doit être une puissance de deux
+  CircularBuffer odd(1000);
+  CHECK(!odd.valid());
+
+  uint8_t storage[64];
+  CircularBuffer external(storage, sizeof(storage));
+  CHECK(external.valid());
+  CHECK(external.write("abc", 3) == 3);
+  CHECK(memcmp(storage, "abc", 3) == 0);
+}
+
+void test_copy_wrap() {
+  CircularBuffer buffer(16);
+  uint8_t data[16];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = i;
+  }
+  uint8_t out[16];
+
+  CHECK(buffer.write(data, 10) == 10);
+  CHECK(buffer.read(out, 6) == 6);
+  CHECK(memcmp(out, data, 6) == 0);
+  // 12 octets à partir de la position 10 : passage par la fin du stockage
+  CHECK(buffer.write(data, 12) == 12);
+  CHECK(buffer.isFull());
+  CHECK(buffer.write(data, 1) == 0);
+  CHECK(buffer.available() == 16);
+  CHECK(buffer.read(out, 16) == 16);
+  CHECK(memcmp(out, data + 6, 4) == 0);
+  CHECK(memcmp(out + 4, data, 12) == 0);
+  CHECK(buffer.isEmpty());
+  CHECK(buffer.read(out, 1) == 0);
+
+  // Écriture tronquée à la place libre
+  CHECK(buffer.write(data, 16) == 16);
+  CHECK(buffer.read(out, 3) == 3);
+  CHECK(buffer.write(data, 8) == 3);
+
+  buffer.clear();
+  CHECK(buffer.isEmpty());
+  CHECK(buffer.available_for_write() == 16);
+}
+
+void test_spans() {
+  CircularBuffer buffer(16);
+  CircularBuffer::Span span = buffer.acquire_write_span();
+  CHECK(span.size == 16);
+  memset(span.data, 'a', 12);
+  buffer.commit(12);
+
+  span = buffer.acquire_read_span();
+  CHECK(span.size == 12);
+  buffer.release(8);
+
+  // Place libre de 12 octets, dont 4 avant la fin du stockage : le span s'arrête à la fin
+  span = buffer.acquire_write_span();
+  CHECK(span.size == 4);
+  memset(span.data, 'b', 4);
+  buffer.commit(4);
+  span = buffer.acquire_write_span();
+  CHECK(span.size == 8);
+  memset(span.data, 'c', 8);
+  buffer.commit(8);
+  CHECK(buffer.isFull());
+  CHECK(buffer.acquire_write_span().size == 0);
+
+  // Lecture dans l'ordre d'écriture, en deux spans
+  span = buffer.acquire_read_span();
+  CHECK(span.size == 8);
+  CHECK(memcmp(span.data, "aaaabbbb", 8) == 0);
+  buffer.release(8);
+  span = buffer.acquire_read_span();
+  CHECK(span.size == 8);
+  CHECK(memcmp(span.data, "cccccccc", 8) == 0);
+  buffer.release(8);
+  CHECK(buffer.isEmpty());
+  CHECK(buffer.acquire_read_span().size == 0);
+}
+
+// Deux threads, tailles de blocs aléatoires, spans et copies mêlés : chaque octet lu doit
+// être celui écrit à la même position du flux
+void test_two_threads() {
+  static const uint64_t TOTAL = 64ull << 20;
+  CircularBuffer buffer(4096);
+
+  std::thread producer([&]() {
+    std::mt19937 random(1);
+    std::vector<uint8_t> chunk(1500);
+    uint64_t position = 0;
+    while (position < TOTAL) {
+      size_t wanted = std::min<uint64_t>(1 + random() % chunk.size(), TOTAL - position);
+      if (random() % 2 == 0) {
+        CircularBuffer::Span span = buffer.acquire_write_span();
+        size_t count = std::min(span.size, wanted);
+        for (size_t i = 0; i < count; i++) {
+          span.data[i] = stream_byte(position + i);
+        }
+        buffer.commit(count);
+        position += count;
+      } else {
+        for (size_t i = 0; i < wanted; i++) {
+          chunk[i] = stream_byte(position + i);
+        }
+        // write() peut n'en prendre qu'une partie : le reste est réécrit au tour suivant
+        position += buffer.write(chunk.data(), wanted);
+      }
+      if (buffer.isFull()) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::mt19937 random(2);
+  std::vector<uint8_t> chunk(1500);
+  uint64_t position = 0;
+  bool intact = true;
+  while (position < TOTAL) {
+    size_t wanted = 1 + random() % chunk.size();
+    const uint8_t *data;
+    size_t count;
+    CircularBuffer::Span span{nullptr, 0};
+    if (random() % 2 == 0) {
+      span = buffer.acquire_read_span();
+      data = span.data;
+      count = std::min(span.size, wanted);
+    } else {
+      data = chunk.data();
+      count = buffer.read(chunk.data(), wanted);
+    }
+    for (size_t i = 0; i < count && intact; i++) {
+      intact = data[i] == stream_byte(position + i);
+    }
+    if (span.data != nullptr) {
+      buffer.release(count);
+    }
+    position += count;
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  CHECK(intact);
+  CHECK(buffer.isEmpty());
+}
+
+}  // namespace
+
+int main() {
+  test_capacity();
+  test_copy_wrap();
+  test_spans();
+  test_two_threads();
+  if (failures > 0) {
+    fprintf(stderr, "circular_buffer_test: %d failure(s)\n", failures);
+    return 1;
+  }
+  printf("circular_buffer_test: ok\n");
+  return 0;
+}
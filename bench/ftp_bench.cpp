@@ -0,0 +1,944 @@
+// Banc de mesure de ftp_server : N clients scriptés en parallèle, chacun sur sa propre
+// connexion de contrôle. Mesure le débit de commandes, la latence des listings et le débit
+// des RETR/STOR. Fonctionne contre le build host (ftp_server_host.yaml) comme contre un
+// appareil ; seul le protocole FTP est utilisé, les fichiers de test sont créés par STOR.
+// Avec --server-pid (serveur host sur la même machine), le temps CPU consommé par le
+// serveur pendant chaque phase est lu dans /proc et rapporté à l'unité de la phase.
+// Avec --mode Z, les transferts sont compressés et les octets sur le fil sont rapportés.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t IO_SIZE = 64 * 1024;
+static const int TIMEOUT_S = 30;
+static const char *LIST_DIRECTORY = "bench_list";
+
+// Contenu des fichiers de test, reproductible à partir de la seule position.
+//   pattern : motif arithmétique, vérifiable sans table
+//   text    : lignes CSV de journal, qui se compressent comme les fichiers réels
+//   random  : octets pseudo-aléatoires, incompressibles comme un fichier déjà compressé
+// text et random répètent un bloc de 1 Mo, bien plus grand que la fenêtre de deflate.
+class TestContent {
+ public:
+  explicit TestContent(const std::string &kind = "pattern") : kind_(kind) {
+    static const size_t BLOCK_SIZE = 1 << 20;
+    std::mt19937_64 random(1234);
+    if (kind == "random") {
+      block_.resize(BLOCK_SIZE);
+      for (char &byte : block_) {
+        byte = static_cast<char>(random());
+      }
+    } else if (kind == "text") {
+      static const char *const SENSORS[] = {"temperature", "humidity", "pressure", "battery", "rssi"};
+      std::string text;
+      for (uint64_t second = 1714521600; text.size() < BLOCK_SIZE; second += 1 + random() % 5) {
+        char line[128];
+        time_t time = static_cast<time_t>(second);
+        struct tm fields;
+        gmtime_r(&time, &fields);
+        size_t len = strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%SZ", &fields);
+        snprintf(line + len, sizeof(line) - len, ",node_%02u,%s,%.2f,%s\n", static_cast<unsigned>(random() % 24),
+                 SENSORS[random() % 5], (random() % 100000) / 100.0, random() % 50 == 0 ? "warn" : "ok");
+        text += line;
+      }
+      block_.assign(text.begin(), text.begin() + BLOCK_SIZE);
+    }
+  }
+
+  const std::string &kind() const { return kind_; }
+  bool is_valid() const { return kind_ == "pattern" || !block_.empty(); }
+
+  void fill(char *data, size_t len, uint64_t offset) const {
+    if (block_.empty()) {
+      for (size_t i = 0; i < len; i++) {
+        uint64_t position = offset + i;
+        data[i] = static_cast<char>((position * 131 + (position >> 12)) & 0xff);
+      }
+      return;
+    }
+    while (len > 0) {
+      size_t start = offset % block_.size();
+      size_t count = std::min(len, block_.size() - start);
+      memcpy(data, block_.data() + start, count);
+      data += count;
+      len -= count;
+      offset += count;
+    }
+  }
+
+  bool matches(const char *data, size_t len, uint64_t offset) const {
+    char expected[IO_SIZE];
+    while (len > 0) {
+      size_t count = std::min(len, sizeof(expected));
+      fill(expected, count, offset);
+      if (memcmp(data, expected, count) != 0) {
+        return false;
+      }
+      data += count;
+      len -= count;
+      offset += count;
+    }
+    return true;
+  }
+
+ protected:
+  std::string kind_;
+  std::vector<char> block_;  // vide pour pattern
+};
+
+struct Options {
+  std::string host{"127.0.0.1"};
+  uint16_t port{2121};
+  std::string user{"bench"};
+  std::string password{"bench"};
+  int clients{4};
+  int commands{500};       // commandes par client
+  int batch{32};           // commandes par envoi de la phase pipeline
+  int list_entries{200};   // fichiers du répertoire listé
+  int lists{50};           // listings par client
+  std::string list_command{"LIST"};
+  size_t file_size{8 << 20};
+  double slow_rate{4e6};   // octets/s du gros transfert de la phase concurrent
+  int server_pid{0};       // 0 : serveur distant, pas de mesure CPU
+  bool mode_z{false};      // transferts en MODE Z
+  TestContent content;
+  std::vector<std::string> phases{"commands", "pipeline", "list", "stor", "retr", "concurrent"};
+};
+
+double seconds_between(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+// receive_buffer : taille de SO_RCVBUF, 0 pour celle du système
+int connect_to(const sockaddr_in &address, int receive_buffer = 0) {
+  int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock < 0) {
+    return -1;
+  }
+  if (receive_buffer > 0) {
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+  }
+  struct timeval timeout = {TIMEOUT_S, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if (connect(sock, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+bool send_all(int sock, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+// Client FTP minimal : connexion de contrôle, réponses multi-lignes, données en EPSV,
+// compressées par zlib en MODE Z
+class FTPClient {
+ public:
+  ~FTPClient() {
+    if (sock_ >= 0) {
+      close(sock_);
+    }
+  }
+
+  bool open(const Options &options, const sockaddr_in &address) {
+    options_ = &options;
+    address_ = address;
+    sock_ = connect_to(address);
+    if (sock_ < 0) {
+      return fail("connect", errno);
+    }
+    int flag = 1;
+    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (read_reply() != 220) {
+      return fail("banner", 0);
+    }
+    int code = command("USER " + options.user);
+    if (code == 331) {
+      code = command("PASS " + options.password);
+    }
+    if (code != 230) {
+      return fail("login", code);
+    }
+    if (command("TYPE I") != 200) {
+      return fail("TYPE I", 0);
+    }
+    return !options.mode_z || command("MODE Z") == 200 || fail("MODE Z", 0);
+  }
+
+  bool send_line(const std::string &line) { return send_text(line + "\r\n"); }
+
+  // Lignes déjà terminées par CRLF, envoyées d'un bloc sans attendre les réponses
+  bool send_text(const std::string &text) { return send_all(sock_, text.data(), text.size()); }
+
+  // Code de la réponse complète (dernière ligne d'une réponse multi-lignes), -1 si coupée
+  int read_reply(std::string *text = nullptr) {
+    std::string line;
+    if (!read_line(line) || line.size() < 3) {
+      return -1;
+    }
+    int code = atoi(line.substr(0, 3).c_str());
+    if (line.size() > 3 && line[3] == '-') {
+      std::string end = line.substr(0, 3) + " ";
+      do {
+        if (!read_line(line)) {
+          return -1;
+        }
+      } while (line.compare(0, 4, end) != 0);
+    }
+    if (text != nullptr) {
+      *text = line;
+    }
+    return code;
+  }
+
+  int command(const std::string &line, std::string *text = nullptr) {
+    return send_line(line) ? read_reply(text) : -1;
+  }
+
+  // Connexion de données en EPSV : l'adresse est celle du serveur, quelle que soit l'interface
+  int open_data() {
+    std::string text;
+    if (command("EPSV", &text) != 229) {
+      fail("EPSV", 0);
+      return -1;
+    }
+    size_t start = text.find("(|||");
+    if (start == std::string::npos) {
+      fail("EPSV reply", 0);
+      return -1;
+    }
+    sockaddr_in data_address = address_;
+    data_address.sin_port = htons(atoi(text.c_str() + start + 4));
+    int data = connect_to(data_address, data_receive_buffer_);
+    if (data < 0) {
+      fail("data connect", errno);
+    }
+    return data;
+  }
+
+  // Commande de transfert vers le client (RETR, LIST, ...) ; sink reçoit chaque bloc,
+  // décompressé en MODE Z, et bytes leur total
+  bool download(const std::string &line, const std::function<bool(const char *, size_t)> &sink, uint64_t &bytes) {
+    int data = open_data();
+    if (data < 0) {
+      return false;
+    }
+    int code = command(line);
+    if (code != 150 && code != 125) {
+      close(data);
+      return fail(line.c_str(), code);
+    }
+    std::vector<char> buffer(IO_SIZE);
+    std::vector<char> output(IO_SIZE);
+    z_stream stream{};
+    bool compressed = options_->mode_z;
+    bool ended = !compressed;
+    if (compressed) {
+      inflateInit(&stream);
+    }
+    bytes = 0;
+    bool ok = true;
+    auto deliver = [&](const char *chunk, size_t len) {
+      if (ok && !sink(chunk, len)) {
+        ok = false;
+      }
+      bytes += len;
+    };
+    ssize_t received;
+    while ((received = recv(data, buffer.data(), buffer.size(), 0)) > 0) {
+      wire_bytes_ += received;
+      if (!compressed) {
+        deliver(buffer.data(), received);
+        continue;
+      }
+      stream.next_in = reinterpret_cast<Bytef *>(buffer.data());
+      stream.avail_in = received;
+      while (stream.avail_in > 0 && !ended) {
+        stream.next_out = reinterpret_cast<Bytef *>(output.data());
+        stream.avail_out = output.size();
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END) {
+          ok = fail("inflate", status);
+          break;
+        }
+        deliver(output.data(), output.size() - stream.avail_out);
+        ended = status == Z_STREAM_END;
+      }
+    }
+    if (compressed) {
+      inflateEnd(&stream);
+    }
+    if (received < 0) {
+      ok = fail("data recv", errno);
+    } else if (!ended) {
+      ok = fail("MODE Z stream end", 0);
+    }
+    close(data);
+    code = read_reply();
+    return (code == 226 || fail(line.c_str(), code)) && ok;
+  }
+
+  // STOR de size octets du contenu de test, compressés en MODE Z
+  bool upload(const std::string &path, uint64_t size) {
+    int data = open_data();
+    if (data < 0) {
+      return false;
+    }
+    int code = command("STOR " + path);
+    if (code != 150 && code != 125) {
+      close(data);
+      return fail("STOR", code);
+    }
+    std::vector<char> buffer(IO_SIZE);
+    std::vector<char> output(IO_SIZE);
+    z_stream stream{};
+    bool compressed = options_->mode_z;
+    if (compressed) {
+      deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+    }
+    auto transmit = [&](const char *chunk, size_t len) {
+      wire_bytes_ += len;
+      return send_all(data, chunk, len) || fail("data send", errno);
+    };
+    // Compresse le bloc (vide avec Z_FINISH) et envoie tout ce que deflate produit
+    auto compress = [&](const char *chunk, size_t len, int flush) {
+      stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(chunk));
+      stream.avail_in = len;
+      int status;
+      do {
+        stream.next_out = reinterpret_cast<Bytef *>(output.data());
+        stream.avail_out = output.size();
+        status = deflate(&stream, flush);
+        if (!transmit(output.data(), output.size() - stream.avail_out)) {
+          return false;
+        }
+      } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+      return true;
+    };
+    bool ok = true;
+    for (uint64_t offset = 0; ok && offset < size; offset += buffer.size()) {
+      size_t count = std::min<uint64_t>(buffer.size(), size - offset);
+      options_->content.fill(buffer.data(), count, offset);
+      ok = compressed ? compress(buffer.data(), count, Z_NO_FLUSH) : transmit(buffer.data(), count);
+    }
+    if (compressed) {
+      ok = ok && compress(nullptr, 0, Z_FINISH);
+      deflateEnd(&stream);
+    }
+    close(data);
+    code = read_reply();
+    return (code == 226 || fail("STOR", code)) && ok;
+  }
+
+  // Fenêtre de réception des connexions de données suivantes, 0 pour celle du système
+  void set_data_receive_buffer(int size) { data_receive_buffer_ = size; }
+
+  // Octets passés sur les connexions de données, compressés en MODE Z
+  uint64_t wire_bytes() const { return wire_bytes_; }
+
+  bool fail(const char *what, int detail) {
+    fprintf(stderr, "ftp_bench: %s failed (%d)\n", what, detail);
+    return false;
+  }
+
+ protected:
+  bool read_line(std::string &line) {
+    while (true) {
+      size_t newline = buffer_.find('\n');
+      if (newline != std::string::npos) {
+        line = buffer_.substr(0, newline);
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        buffer_.erase(0, newline + 1);
+        return true;
+      }
+      char chunk[1024];
+      ssize_t received = recv(sock_, chunk, sizeof(chunk), 0);
+      if (received <= 0) {
+        return false;
+      }
+      buffer_.append(chunk, received);
+    }
+  }
+
+  const Options *options_{nullptr};
+  int sock_{-1};
+  sockaddr_in address_{};
+  int data_receive_buffer_{0};
+  uint64_t wire_bytes_{0};
+  std::string buffer_;  // octets reçus sur la connexion de contrôle, pas encore découpés
+};
+
+// Résultat d'un client pour une phase
+struct ClientResult {
+  bool ok{false};
+  uint64_t operations{0};
+  uint64_t bytes{0};
+  uint64_t wire_bytes{0};
+  Clock::time_point started;
+  Clock::time_point finished;
+  std::vector<double> latencies;  // secondes, une par opération chronométrée
+};
+
+// Temps CPU (utilisateur + système, tous threads) consommé par le processus pid, -1 s'il
+// est illisible. Résolution d'un tick d'horloge, soit 10 ms en général : à rapporter à des
+// phases d'au moins quelques secondes.
+double process_cpu_seconds(int pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return -1;
+  }
+  char line[1024];
+  size_t len = fread(line, 1, sizeof(line) - 1, file);
+  fclose(file);
+  line[len] = '\0';
+  // Le nom du processus, entre parenthèses, peut contenir des espaces : les champs sont
+  // comptés à partir de la dernière parenthèse fermante (state est le champ 3)
+  const char *fields = strrchr(line, ')');
+  unsigned long long utime, stime;
+  if (fields == nullptr ||
+      sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+    return -1;
+  }
+  return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Connecte tous les clients, puis les lance ensemble : la connexion et le login ne sont
+// pas comptés dans la phase. server_cpu reçoit le temps CPU du serveur entre le départ
+// et la fin du dernier client, -1 sans --server-pid.
+std::vector<ClientResult> run_clients(const Options &options, const sockaddr_in &address,
+                                      const std::function<bool(FTPClient &, int, ClientResult &)> &body,
+                                      double *server_cpu = nullptr) {
+  std::vector<ClientResult> results(options.clients);
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  for (int index = 0; index < options.clients; index++) {
+    threads.emplace_back([&, index]() {
+      FTPClient client;
+      ClientResult &result = results[index];
+      bool connected = client.open(options, address);
+      ready++;
+      while (!go.load()) {
+        std::this_thread::yield();
+      }
+      result.started = Clock::now();
+      result.ok = connected && body(client, index, result);
+      result.finished = Clock::now();
+      result.wire_bytes = client.wire_bytes();
+      if (result.ok) {
+        client.command("QUIT");
+      }
+    });
+  }
+  while (ready.load() < options.clients) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double cpu_start = options.server_pid > 0 ? process_cpu_seconds(options.server_pid) : -1;
+  go.store(true);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  if (server_cpu != nullptr) {
+    double cpu_end = cpu_start >= 0 ? process_cpu_seconds(options.server_pid) : -1;
+    *server_cpu = cpu_end >= 0 ? cpu_end - cpu_start : -1;
+  }
+  return results;
+}
+
+// Suffixe des lignes de résultat : CPU serveur par unité de la phase (scale convertit les
+// secondes, unit la nomme), vide sans mesure
+std::string server_cpu_per(double cpu_seconds, double units, double scale, const char *unit) {
+  if (cpu_seconds < 0 || units <= 0) {
+    return "";
+  }
+  char text[64];
+  snprintf(text, sizeof(text), "  server %.2f %s", cpu_seconds * scale / units, unit);
+  return text;
+}
+
+// Durée de la phase : du premier départ à la dernière arrivée
+double wall_time(const std::vector<ClientResult> &results) {
+  Clock::time_point start = results.front().started;
+  Clock::time_point end = results.front().finished;
+  for (const ClientResult &result : results) {
+    start = std::min(start, result.started);
+    end = std::max(end, result.finished);
+  }
+  return seconds_between(start, end);
+}
+
+bool all_ok(const std::vector<ClientResult> &results) {
+  return std::all_of(results.begin(), results.end(), [](const ClientResult &result) { return result.ok; });
+}
+
+double percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+  return values[index];
+}
+
+// Un fichier par client et par contenu : ensure_file ne vérifie que la taille
+std::string client_file(const Options &options, int index) {
+  return "bench_" + options.content.kind() + "_" + std::to_string(index) + ".bin";
+}
+
+static const char *const COMMAND_SCRIPT[] = {"NOOP", "PWD", "TYPE I", "SYST"};
+
+void print_commands(const char *name, const Options &options, const std::vector<ClientResult> &results,
+                    double server_cpu) {
+  uint64_t total = 0;
+  for (const ClientResult &result : results) {
+    total += result.operations;
+  }
+  double seconds = wall_time(results);
+  printf("%-9s %2d clients  %8llu cmds  %7.3f s  %10.0f cmd/s%s\n", name, options.clients, (unsigned long long) total,
+         seconds, total / seconds, server_cpu_per(server_cpu, total, 1e6, "us/cmd").c_str());
+}
+
+// Allers-retours de commandes sans transfert : une commande par passage de loop(), le
+// débit suit surtout la cadence de la boucle
+bool phase_commands(const Options &options, const sockaddr_in &address) {
+  double server_cpu;
+  auto results = run_clients(
+      options, address,
+      [&](FTPClient &client, int, ClientResult &result) {
+        for (int i = 0; i < options.commands; i++) {
+          int code = client.command(COMMAND_SCRIPT[i % 4]);
+          if (code < 200 || code >= 300) {
+            return client.fail(COMMAND_SCRIPT[i % 4], code);
+          }
+          result.operations++;
+        }
+        return true;
+      },
+      &server_cpu);
+  print_commands("commands", options, results, server_cpu);
+  return all_ok(results);
+}
+
+// Mêmes commandes envoyées par lots de batch dans un seul segment, réponses lues ensuite :
+// le serveur en exécute un lot par passage, le débit et le CPU par commande mesurent alors
+// le coût de l'analyse et de la distribution plutôt que l'aller-retour
+bool phase_pipeline(const Options &options, const sockaddr_in &address) {
+  double server_cpu;
+  auto results = run_clients(
+      options, address,
+      [&](FTPClient &client, int, ClientResult &result) {
+        for (int sent = 0; sent < options.commands;) {
+          int count = std::min(options.batch, options.commands - sent);
+          std::string text;
+          for (int i = 0; i < count; i++) {
+            text += COMMAND_SCRIPT[(sent + i) % 4];
+            text += "\r\n";
+          }
+          if (!client.send_text(text)) {
+            return client.fail("batch send", errno);
+          }
+          for (int i = 0; i < count; i++) {
+            int code = client.read_reply();
+            if (code < 200 || code >= 300) {
+              return client.fail(COMMAND_SCRIPT[(sent + i) % 4], code);
+            }
+            result.operations++;
+          }
+          sent += count;
+        }
+        return true;
+      },
+      &server_cpu);
+  print_commands("pipeline", options, results, server_cpu);
+  return all_ok(results);
+}
+
+// Nombre d'entrées du répertoire listé, -1 en cas d'échec
+int count_list_entries(FTPClient &client) {
+  int lines = 0;
+  uint64_t bytes;
+  bool ok = client.download(
+      std::string("NLST ") + LIST_DIRECTORY,
+      [&](const char *data, size_t len) {
+        lines += std::count(data, data + len, '\n');
+        return true;
+      },
+      bytes);
+  return ok ? lines : -1;
+}
+
+// Répertoire d'au moins list_entries fichiers vides, complété par STOR s'il en manque.
+// run_host_bench.sh crée directement un grand répertoire synthétique sur le disque, un
+// appareil se remplit une fois par le protocole. Renvoie le nombre d'entrées, -1 en cas
+// d'échec.
+int prepare_list_directory(const Options &options, const sockaddr_in &address) {
+  FTPClient client;
+  if (!client.open(options, address)) {
+    return -1;
+  }
+  client.command(std::string("MKD ") + LIST_DIRECTORY);
+  int entries = count_list_entries(client);
+  if (entries < 0 || entries >= options.list_entries) {
+    return entries;
+  }
+  for (int i = 0; i < options.list_entries; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/entry_%05d.txt", LIST_DIRECTORY, i);
+    if (client.command(std::string("SIZE ") + name) != 213 && !client.upload(name, 0)) {
+      return -1;
+    }
+  }
+  return count_list_entries(client);
+}
+
+// Listings répétés du même répertoire : latence de la commande jusqu'au 226. Pour le
+// nombre d'appels système par listing, run_host_bench.sh fait tourner le serveur sous
+// strace (STRACE=1) ; la préparation n'ajoute qu'un NLST au décompte.
+bool phase_list(const Options &options, const sockaddr_in &address) {
+  int entries = prepare_list_directory(options, address);
+  if (entries < 0) {
+    return false;
+  }
+  const std::string line = options.list_command + " " + LIST_DIRECTORY;
+  auto results = run_clients(options, address, [&](FTPClient &client, int, ClientResult &result) {
+    for (int i = 0; i < options.lists; i++) {
+      uint64_t bytes;
+      Clock::time_point start = Clock::now();
+      if (!client.download(line, [](const char *, size_t) { return true; }, bytes)) {
+        return false;
+      }
+      result.latencies.push_back(seconds_between(start, Clock::now()));
+      result.bytes += bytes;
+      result.operations++;
+    }
+    return true;
+  });
+  std::vector<double> latencies;
+  for (const ClientResult &result : results) {
+    latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+  }
+  uint64_t bytes = 0;
+  for (const ClientResult &result : results) {
+    bytes += result.bytes;
+  }
+  printf("list      %2d clients  %8zu lists %7.3f s  p50 %7.2f ms  p99 %7.2f ms  (%s, %d entries, %.0f bytes)\n",
+         options.clients, latencies.size(), wall_time(results), percentile(latencies, 0.5) * 1000,
+         percentile(latencies, 0.99) * 1000, options.list_command.c_str(), entries,
+         latencies.empty() ? 0.0 : static_cast<double>(bytes) / latencies.size());
+  return all_ok(results);
+}
+
+void print_throughput(const char *name, const Options &options, const std::vector<ClientResult> &results,
+                      double server_cpu) {
+  uint64_t total = 0;
+  uint64_t wire = 0;
+  double slowest = 0;
+  for (const ClientResult &result : results) {
+    total += result.bytes;
+    wire += result.wire_bytes;
+    double rate = result.bytes / seconds_between(result.started, result.finished) / 1e6;
+    slowest = slowest == 0 ? rate : std::min(slowest, rate);
+  }
+  double seconds = wall_time(results);
+  std::string compression;
+  if (options.mode_z && wire > 0) {
+    char text[64];
+    snprintf(text, sizeof(text), "  wire %.1f MB (%.2fx)", wire / 1e6, static_cast<double>(total) / wire);
+    compression = text;
+  }
+  printf("%-9s %2d clients  %8.1f MB   %7.3f s  %8.2f MB/s  (slowest client %.2f MB/s, %s)%s%s\n", name,
+         options.clients, total / 1e6, seconds, total / seconds / 1e6, slowest, options.content.kind().c_str(),
+         compression.c_str(), server_cpu_per(server_cpu, total / 1e6, 1e3, "ms/MB").c_str());
+}
+
+// Chaque client envoie son propre fichier
+bool phase_stor(const Options &options, const sockaddr_in &address) {
+  double server_cpu;
+  auto results = run_clients(
+      options, address,
+      [&](FTPClient &client, int index, ClientResult &result) {
+        if (!client.upload(client_file(options, index), options.file_size)) {
+          return false;
+        }
+        result.bytes = options.file_size;
+        return true;
+      },
+      &server_cpu);
+  print_throughput("stor", options, results, server_cpu);
+  return all_ok(results);
+}
+
+// Envoie le fichier de test s'il est absent ou n'a pas la bonne taille
+bool ensure_file(const Options &options, const sockaddr_in &address, const std::string &path, uint64_t size) {
+  FTPClient client;
+  std::string reply;
+  if (!client.open(options, address)) {
+    return false;
+  }
+  return (client.command("SIZE " + path, &reply) == 213 && strtoull(reply.c_str() + 4, nullptr, 10) == size) ||
+         client.upload(path, size);
+}
+
+// Chaque client relit son fichier et en vérifie le contenu. La boucle de lecture directe
+// (download_buffer_count: 0) et le pipeline de la tâche de lecture se comparent en
+// relançant le serveur avec l'une puis l'autre configuration.
+bool phase_retr(const Options &options, const sockaddr_in &address) {
+  // Fichiers absents si la phase stor n'a pas été demandée
+  for (int index = 0; index < options.clients; index++) {
+    if (!ensure_file(options, address, client_file(options, index), options.file_size)) {
+      return false;
+    }
+  }
+  double server_cpu;
+  auto results = run_clients(
+      options, address,
+      [&](FTPClient &client, int index, ClientResult &result) {
+        uint64_t offset = 0;
+        bool ok = client.download(
+            "RETR " + client_file(options, index),
+            [&](const char *data, size_t len) {
+              bool valid = options.content.matches(data, len, offset);
+              offset += len;
+              return valid;
+            },
+            result.bytes);
+        return (ok || client.fail("RETR content", 0)) &&
+               (result.bytes == options.file_size || client.fail("RETR size", 0));
+      },
+      &server_cpu);
+  print_throughput("retr", options, results, server_cpu);
+  return all_ok(results);
+}
+
+// Ordonnancement des transferts : le client 0 lit un gros fichier au débit de slow_rate,
+// les autres enchaînent de petits RETR pendant ce temps. Avec un transfert qui monopolise
+// sa tâche de travail ou loop(), les petits RETR attendent que le serveur ait fini
+// d'envoyer le gros et la phase échoue. Les tampons TCP absorbent la fin du gros fichier :
+// l'attente est alors une bonne part de sa durée, pas sa totalité.
+bool phase_concurrent(const Options &options, const sockaddr_in &address) {
+  static const uint64_t SHORT_SIZE = 64 * 1024;
+  if (options.clients < 2 || !ensure_file(options, address, "bench_long.bin", options.file_size) ||
+      !ensure_file(options, address, "bench_short.bin", SHORT_SIZE)) {
+    fprintf(stderr, "ftp_bench: concurrent needs --clients 2 or more\n");
+    return false;
+  }
+  std::atomic<bool> long_running{false};
+  std::atomic<bool> long_done{false};
+  auto results = run_clients(options, address, [&](FTPClient &client, int index, ClientResult &result) {
+    if (index == 0) {
+      // Lecture volontairement lente, fenêtre TCP réduite : le socket de données du serveur
+      // reste plein au lieu que le fichier entier parte dans les tampons du noyau
+      client.set_data_receive_buffer(64 * 1024);
+      Clock::time_point start = Clock::now();
+      uint64_t received = 0;
+      bool ok = client.download(
+          "RETR bench_long.bin",
+          [&](const char *, size_t len) {
+            received += len;
+            long_running.store(true);
+            double ahead = received / options.slow_rate - seconds_between(start, Clock::now());
+            if (ahead > 0) {
+              std::this_thread::sleep_for(std::chrono::duration<double>(ahead));
+            }
+            return true;
+          },
+          result.bytes);
+      long_done.store(true);
+      return ok;
+    }
+    while (!long_running.load() && !long_done.load()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    while (!long_done.load()) {
+      uint64_t bytes;
+      Clock::time_point start = Clock::now();
+      if (!client.download("RETR bench_short.bin", [](const char *, size_t) { return true; }, bytes)) {
+        return false;
+      }
+      // Seuls les RETR terminés pendant le gros transfert sont comptés
+      if (!long_done.load()) {
+        result.latencies.push_back(seconds_between(start, Clock::now()));
+      }
+    }
+    return true;
+  });
+  std::vector<double> latencies;
+  for (size_t index = 1; index < results.size(); index++) {
+    latencies.insert(latencies.end(), results[index].latencies.begin(), results[index].latencies.end());
+  }
+  const ClientResult &long_result = results.front();
+  double long_seconds = seconds_between(long_result.started, long_result.finished);
+  double slowest = percentile(latencies, 1.0);
+  printf("concurrent 1 x %.1f MB in %.2f s, %d clients: %zu short RETRs meanwhile, p50 %.2f ms  max %.2f ms\n",
+         long_result.bytes / 1e6, long_seconds, options.clients - 1, latencies.size(), percentile(latencies, 0.5) * 1000,
+         slowest * 1000);
+  if (latencies.empty() || slowest > long_seconds / 4) {
+    fprintf(stderr, "ftp_bench: short RETRs stalled behind the long one\n");
+    return false;
+  }
+  return all_ok(results);
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: ftp_bench [--host A] [--port N] [--user U] [--password P] [--clients N]\n"
+          "                 [--commands N] [--batch N] [--list-entries N] [--lists N]\n"
+          "                 [--list-command LIST|NLST|MLSD]\n"
+          "                 [--file-size BYTES] [--slow-rate BYTES_PER_S] [--server-pid PID]\n"
+          "                 [--mode S|Z] [--data pattern|text|random]\n"
+          "                 [--phases commands,pipeline,list,stor,retr,concurrent]\n");
+}
+
+std::vector<std::string> split(const std::string &text, char separator) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = text.find(separator, start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    if (end > start) {
+      parts.push_back(text.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return parts;
+}
+
+bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string value = argv[++i];
+    if (name == "--host") {
+      options.host = value;
+    } else if (name == "--port") {
+      options.port = atoi(value.c_str());
+    } else if (name == "--user") {
+      options.user = value;
+    } else if (name == "--password") {
+      options.password = value;
+    } else if (name == "--clients") {
+      options.clients = std::max(1, atoi(value.c_str()));
+    } else if (name == "--commands") {
+      options.commands = atoi(value.c_str());
+    } else if (name == "--batch") {
+      options.batch = std::max(1, atoi(value.c_str()));
+    } else if (name == "--list-entries") {
+      options.list_entries = atoi(value.c_str());
+    } else if (name == "--lists") {
+      options.lists = atoi(value.c_str());
+    } else if (name == "--list-command") {
+      options.list_command = value;
+    } else if (name == "--file-size") {
+      options.file_size = strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "--slow-rate") {
+      options.slow_rate = std::max(1.0, atof(value.c_str()));
+    } else if (name == "--server-pid") {
+      options.server_pid = atoi(value.c_str());
+    } else if (name == "--mode") {
+      if (value != "S" && value != "Z") {
+        return false;
+      }
+      options.mode_z = value == "Z";
+    } else if (name == "--data") {
+      options.content = TestContent(value);
+      if (!options.content.is_valid()) {
+        return false;
+      }
+    } else if (name == "--phases") {
+      options.phases = split(value, ',');
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  struct addrinfo hints = {};
+  struct addrinfo *info;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(options.host.c_str(), nullptr, &hints, &info) != 0) {
+    fprintf(stderr, "ftp_bench: cannot resolve %s\n", options.host.c_str());
+    return 2;
+  }
+  sockaddr_in address = *reinterpret_cast<sockaddr_in *>(info->ai_addr);
+  address.sin_port = htons(options.port);
+  freeaddrinfo(info);
+
+  static const struct {
+    const char *name;
+    bool (*run)(const Options &, const sockaddr_in &);
+  } PHASES[] = {
+      {"commands", phase_commands},
+      {"pipeline", phase_pipeline},
+      {"list", phase_list},
+      {"stor", phase_stor},
+      {"retr", phase_retr},
+      {"concurrent", phase_concurrent},
+  };
+
+  bool ok = true;
+  for (const std::string &phase : options.phases) {
+    auto it = std::find_if(std::begin(PHASES), std::end(PHASES), [&](const auto &entry) { return phase == entry.name; });
+    if (it == std::end(PHASES)) {
+      fprintf(stderr, "ftp_bench: unknown phase %s\n", phase.c_str());
+      return 2;
+    }
+    if (!it->run(options, address)) {
+      fprintf(stderr, "ftp_bench: phase %s failed\n", phase.c_str());
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Équivalent host de l'allocateur d'ESP-IDF pour compiler les composants sur le PC :
+// PSRAM et RAM interne sont la même mémoire
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+inline void *heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline void heap_caps_free(void *buffer) { free(buffer); }
@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+# Compile ftp_server pour la plateforme host, le démarre sur un répertoire vide puis lance
+# ftp_bench contre lui. Les arguments sont transmis à ftp_bench, avec --server-pid pour
+# le CPU consommé par le serveur.
+#   ESPHOME_ARGS : options passées à esphome, par exemple "-s transfer_workers 0"
+#   BENCH_BUILD  : répertoire de build CMake de ftp_bench (build/bench par défaut)
+#   SYNTHETIC_ENTRIES : fichiers vides créés dans bench_list, le répertoire de la phase
+#                  list (5000 par défaut)
+#   STRACE       : si non vide, le serveur tourne sous strace -f -c et le décompte de ses
+#                  appels système est affiché à la fin ; les temps mesurés sont alors faussés
+set -eu
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(dirname "$BENCH_DIR")
+BENCH_BUILD=${BENCH_BUILD:-$REPO_DIR/build/bench}
+ROOT_PATH=/tmp/ftp_bench_root
+PROGRAM=$BENCH_DIR/.esphome/build/ftp-server-host/.pioenvs/ftp-server-host/program
+
+# shellcheck disable=SC2086
+esphome ${ESPHOME_ARGS:-} compile "$BENCH_DIR/ftp_server_host.yaml"
+cmake -S "$BENCH_DIR" -B "$BENCH_BUILD" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BENCH_BUILD" --target ftp_bench
+
+rm -rf "$ROOT_PATH"
+mkdir -p "$ROOT_PATH/bench_list"
+(cd "$ROOT_PATH/bench_list" && seq -f 'entry_%05g.txt' 0 $((${SYNTHETIC_ENTRIES:-5000} - 1)) | xargs -r touch)
+
+if [ -n "${STRACE:-}" ]; then
+  STRACE_LOG=$(mktemp)
+  strace -f -c -o "$STRACE_LOG" "$PROGRAM" &
+  TRACER_PID=$!
+  SERVER_PID=
+  while [ -z "$SERVER_PID" ]; do
+    sleep 0.1
+    SERVER_PID=$(pgrep -P "$TRACER_PID" || true)
+  done
+else
+  "$PROGRAM" &
+  SERVER_PID=$!
+fi
+trap 'kill $SERVER_PID 2>/dev/null || true' EXIT INT TERM
+
+# Attente de l'écoute du port de contrôle
+for _ in $(seq 50); do
+  if (exec 3<>/dev/tcp/127.0.0.1/2121) 2>/dev/null; then
+    break
+  fi
+  sleep 0.1
+done
+
+STATUS=0
+"$BENCH_BUILD/ftp_bench" --port 2121 --server-pid "$SERVER_PID" "$@" || STATUS=$?
+
+if [ -n "${STRACE:-}" ]; then
+  # strace écrit son résumé à la fin du processus suivi
+  kill "$SERVER_PID"
+  wait "$TRACER_PID" || true
+  cat "$STRACE_LOG"
+  rm -f "$STRACE_LOG"
+fi
+exit $STATUS
@@ -3,10 +3,14 @@ import esphome.config_validation as cv
 
 CONF_ID = 'id'  # Add this line to define CONF_ID
 CONF_SERVER = 'server'
+CONF_FTP_PORT = 'ftp_port'
 CONF_USERNAME = 'username'
 CONF_PASSWORD = 'password'
 CONF_REMOTE_PATHS = 'remote_paths'
 CONF_LOCAL_PORT = 'local_port'
+CONF_MAX_CONNECTIONS = 'max_connections'
+CONF_IDLE_TIMEOUT = 'idle_timeout'
+CONF_MAX_DOWNLOADS = 'max_downloads'
 
 DEPENDENCIES = []
 AUTO_LOAD = []
@@ -20,14 +24,27 @@ def validate_remote_paths(value):
         raise cv.Invalid("Remote paths must be a list of strings")
     return [cv.string(path) for path in value]
 
-CONFIG_SCHEMA = cv.Schema({
+def validate_max_downloads(config):
+    # Chaque téléchargement en cours occupe une connexion de contrôle du pool
+    if config[CONF_MAX_DOWNLOADS] > config[CONF_MAX_CONNECTIONS]:
+        raise cv.Invalid("max_downloads ne peut pas dépasser max_connections")
+    return config
+
+CONFIG_SCHEMA = cv.All(cv.Schema({
     cv.Required(CONF_ID): cv.declare_id(FTPHTTPProxy),  # Declare the ID for the component
     cv.Required(CONF_SERVER): cv.string,
+    # Port de contrôle du serveur FTP amont
+    cv.Optional(CONF_FTP_PORT, default=21): cv.port,
     cv.Required(CONF_USERNAME): cv.string,
     cv.Required(CONF_PASSWORD): cv.string,
     cv.Required(CONF_REMOTE_PATHS): validate_remote_paths,
     cv.Optional(CONF_LOCAL_PORT, default=8000): cv.port,
-})
+    # Connexions de contrôle FTP gardées ouvertes et authentifiées entre les requêtes
+    cv.Optional(CONF_MAX_CONNECTIONS, default=3): cv.int_range(min=1, max=4),
+    cv.Optional(CONF_IDLE_TIMEOUT, default='30s'): cv.positive_time_period_milliseconds,
+    # Téléchargements servis en parallèle ; au-delà, réponse 503
+    cv.Optional(CONF_MAX_DOWNLOADS, default=3): cv.int_range(min=1, max=4),
+}), validate_max_downloads)
 
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
@@ -35,6 +52,7 @@ async def to_code(config):
     
     # Configuration des paramètres
     cg.add(var.set_ftp_server(config[CONF_SERVER]))
+    cg.add(var.set_ftp_port(config[CONF_FTP_PORT]))
     cg.add(var.set_username(config[CONF_USERNAME]))
     cg.add(var.set_password(config[CONF_PASSWORD]))
     
@@ -43,3 +61,6 @@ async def to_code(config):
         cg.add(var.add_remote_path(remote_path))
     
     cg.add(var.set_local_port(config[CONF_LOCAL_PORT]))
+    cg.add(var.set_max_connections(config[CONF_MAX_CONNECTIONS]))
+    cg.add(var.set_idle_timeout(config[CONF_IDLE_TIMEOUT]))
+    cg.add(var.set_max_downloads(config[CONF_MAX_DOWNLOADS]))
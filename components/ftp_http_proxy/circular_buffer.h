@@ -1,194 +1,262 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include "esp_heap_caps.h"
 
 namespace esphome {
 namespace ftp_http_proxy {
 
 /**
- * @brief Class implementing a circular buffer for efficient data streaming
- * 
- * This buffer allows continuous writing and reading of data without having
- * to move memory around, which is particularly useful for streaming applications.
+ * @brief Lock-free single-producer/single-consumer circular buffer
+ *
+ * One task writes and one task reads, without any lock: the write index (head)
+ * is only modified by the producer and the read index (tail) only by the
+ * consumer. Both indexes grow freely and are masked on access, so the capacity
+ * must be a power of two and a full buffer needs no separate flag.
+ *
+ * Besides the copying read()/write(), the span API gives direct access to the
+ * ring memory: recv() can write into acquire_write_span() then commit(), and
+ * httpd_resp_send_chunk() can send from acquire_read_span() then release().
  */
 class CircularBuffer {
 public:
+    /**
+     * @brief Contiguous region of the ring memory
+     */
+    struct Span {
+        uint8_t* data;
+        size_t size;
+    };
+
     /**
      * @brief Construct a new Circular Buffer with the specified size
-     * 
-     * @param size Size of the buffer in bytes
+     *
+     * Storage is taken from PSRAM when available, internal RAM otherwise.
+     *
+     * @param size Size of the buffer in bytes, a power of two
+     */
+    explicit CircularBuffer(size_t size)
+        : buffer_(allocate(size)),
+          mask_(size - 1),
+          owned_(true) {}
+
+    /**
+     * @brief Construct a Circular Buffer over caller-supplied storage
+     *
+     * @param storage Memory used by the buffer, which must outlive it
+     * @param size Size of the storage in bytes, a power of two
      */
-    CircularBuffer(size_t size) 
-        : buffer_(new uint8_t[size]), 
-          size_(size),
-          read_pos_(0),
-          write_pos_(0),
-          full_(false) {}
+    CircularBuffer(uint8_t* storage, size_t size)
+        : buffer_(storage),
+          mask_(size - 1),
+          owned_(false) {}
+
+    CircularBuffer(const CircularBuffer&) = delete;
+    CircularBuffer& operator=(const CircularBuffer&) = delete;
 
     /**
-     * @brief Destroy the Circular Buffer and free allocated memory
+     * @brief Destroy the Circular Buffer and free owned memory
      */
     ~CircularBuffer() {
-        delete[] buffer_;
+        if (owned_) {
+            heap_caps_free(buffer_);
+        }
+    }
+
+    /**
+     * @brief Check that the storage is usable
+     *
+     * @return true Storage is allocated and its size is a power of two
+     * @return false Allocation failed or invalid size
+     */
+    bool valid() const {
+        size_t size = mask_ + 1;
+        return buffer_ != nullptr && size != 0 && (size & mask_) == 0;
     }
 
     /**
      * @brief Get the free space available in the buffer
-     * 
+     *
      * @return size_t Free space in bytes
      */
     size_t freeSpace() const {
         return available_for_write();
-    }    /**
-     * @brief Write data to the buffer
-     * 
+    }
+
+    /**
+     * @brief Get the largest contiguous writable region (producer only)
+     *
+     * The region may be shorter than available_for_write() when the free
+     * space wraps around the end of the storage.
+     *
+     * @return Span Writable region, empty when the buffer is full
+     */
+    Span acquire_write_span() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t offset = head & mask_;
+        size_t free = capacity() - (head - tail);
+        return Span{buffer_ + offset, std::min(free, capacity() - offset)};
+    }
+
+    /**
+     * @brief Publish bytes written into the last write span (producer only)
+     *
+     * @param len Number of bytes written, at most the span size
+     */
+    void commit(size_t len) {
+        head_.store(head_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    /**
+     * @brief Get the largest contiguous readable region (consumer only)
+     *
+     * @return Span Readable region, empty when the buffer is empty
+     */
+    Span acquire_read_span() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t offset = tail & mask_;
+        return Span{buffer_ + offset, std::min(head - tail, capacity() - offset)};
+    }
+
+    /**
+     * @brief Give back bytes consumed from the last read span (consumer only)
+     *
+     * @param len Number of bytes consumed, at most the span size
+     */
+    void release(size_t len) {
+        tail_.store(tail_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    /**
+     * @brief Write data to the buffer (producer only)
+     *
      * @param data Pointer to the data to write
      * @param len Length of the data to write
      * @return size_t Number of bytes actually written
      */
     size_t write(const void* data, size_t len) {
-        if (isFull()) {
-            return 0;
-        }
-
         const uint8_t* input = static_cast<const uint8_t*>(data);
-        size_t bytes_to_write = std::min(len, available_for_write());
-
-        // Write in two steps if wrapping around the buffer end
-        if (write_pos_ + bytes_to_write > size_) {
-            // First part: from write_pos to end of buffer
-            size_t first_part = size_ - write_pos_;
-            std::memcpy(buffer_ + write_pos_, input, first_part);
-            
-            // Second part: from beginning of buffer
-            size_t second_part = bytes_to_write - first_part;
-            std::memcpy(buffer_, input + first_part, second_part);
-            
-            write_pos_ = second_part;
-        } else {
-            // No wrap-around needed
-            std::memcpy(buffer_ + write_pos_, input, bytes_to_write);
-            write_pos_ = (write_pos_ + bytes_to_write) % size_;
-        }
-
-        // Check if buffer became full after this write
-        if (write_pos_ == read_pos_) {
-            full_ = true;
+        size_t written = 0;
+        // At most two spans: up to the end of the storage, then from its start
+        for (int part = 0; part < 2 && written < len; part++) {
+            Span span = acquire_write_span();
+            size_t count = std::min(span.size, len - written);
+            if (count == 0) {
+                break;
+            }
+            std::memcpy(span.data, input + written, count);
+            commit(count);
+            written += count;
         }
-
-        return bytes_to_write;
+        return written;
     }
 
     /**
-     * @brief Read data from the buffer
-     * 
+     * @brief Read data from the buffer (consumer only)
+     *
      * @param data Pointer to where the data should be stored
      * @param len Maximum number of bytes to read
      * @return size_t Number of bytes actually read
      */
     size_t read(void* data, size_t len) {
-        if (isEmpty()) {
-            return 0;
-        }
-
         uint8_t* output = static_cast<uint8_t*>(data);
-        size_t bytes_to_read = std::min(len, available());
-
-        // Read in two steps if wrapping around the buffer end
-        if (read_pos_ + bytes_to_read > size_) {
-            // First part: from read_pos to end of buffer
-            size_t first_part = size_ - read_pos_;
-            std::memcpy(output, buffer_ + read_pos_, first_part);
-            
-            // Second part: from beginning of buffer
-            size_t second_part = bytes_to_read - first_part;
-            std::memcpy(output + first_part, buffer_, second_part);
-            
-            read_pos_ = second_part;
-        } else {
-            // No wrap-around needed
-            std::memcpy(output, buffer_ + read_pos_, bytes_to_read);
-            read_pos_ = (read_pos_ + bytes_to_read) % size_;
+        size_t count_read = 0;
+        for (int part = 0; part < 2 && count_read < len; part++) {
+            Span span = acquire_read_span();
+            size_t count = std::min(span.size, len - count_read);
+            if (count == 0) {
+                break;
+            }
+            std::memcpy(output + count_read, span.data, count);
+            release(count);
+            count_read += count;
         }
-
-        // Buffer is no longer full after reading
-        full_ = false;
-
-        return bytes_to_read;
+        return count_read;
     }
 
     /**
      * @brief Check if the buffer is empty
-     * 
+     *
      * @return true Buffer is empty
      * @return false Buffer contains data
      */
     bool isEmpty() const {
-        return !full_ && (read_pos_ == write_pos_);
+        return available() == 0;
     }
 
     /**
      * @brief Check if the buffer is full
-     * 
+     *
      * @return true Buffer is full
      * @return false Buffer has space available
      */
     bool isFull() const {
-        return full_;
+        return available() == capacity();
     }
 
     /**
      * @brief Get number of bytes available for reading
-     * 
+     *
+     * Exact for the consumer, a lower bound for the producer.
+     *
      * @return size_t Bytes available to read
      */
     size_t available() const {
-        if (full_) {
-            return size_;
-        }
-        
-        if (write_pos_ >= read_pos_) {
-            return write_pos_ - read_pos_;
-        } else {
-            return size_ - (read_pos_ - write_pos_);
-        }
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        return head - tail;
     }
 
     /**
      * @brief Get number of bytes available for writing
-     * 
+     *
+     * Exact for the producer, a lower bound for the consumer.
+     *
      * @return size_t Bytes available to write
      */
     size_t available_for_write() const {
-        return size_ - available();
+        return capacity() - available();
     }
 
     /**
      * @brief Get total capacity of the buffer
-     * 
+     *
      * @return size_t Total buffer capacity in bytes
      */
     size_t capacity() const {
-        return size_;
+        return mask_ + 1;
     }
 
     /**
      * @brief Clear all data from the buffer
+     *
+     * Only valid while neither the producer nor the consumer is running.
      */
     void clear() {
-        read_pos_ = 0;
-        write_pos_ = 0;
-        full_ = false;
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
     }
 
 private:
-    uint8_t* buffer_;   // Buffer memory
-    size_t size_;       // Buffer size
-    size_t read_pos_;   // Current read position
-    size_t write_pos_;  // Current write position
-    bool full_;         // Flag indicating if buffer is full
+    static uint8_t* allocate(size_t size) {
+        void* memory = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (memory == nullptr) {
+            memory = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+        return static_cast<uint8_t*>(memory);
+    }
+
+    uint8_t* buffer_;                // Buffer memory
+    size_t mask_;                    // Capacity - 1
+    bool owned_;                     // Storage allocated by the buffer
+    std::atomic<size_t> head_{0};    // Total bytes written, producer side
+    std::atomic<size_t> tail_{0};    // Total bytes read, consumer side
 };
 
 }  // namespace ftp_http_proxy
@@ -0,0 +1,271 @@
+#include "ftp_control_pool.h"
+#include "esp_log.h"
+#include "esphome/core/hal.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+
+namespace esphome {
+namespace ftp_http_proxy {
+
+static const char *TAG = "ftp_proxy";
+
+FTPControlPool::FTPControlPool() { lock_ = xSemaphoreCreateMutex(); }
+
+FTPControlPool::~FTPControlPool() {
+  for (auto &connection : connections_) {
+    if (connection.sock >= 0) {
+      close_connection_(connection.sock, true);
+    }
+  }
+  if (lock_ != nullptr) {
+    vSemaphoreDelete(lock_);
+  }
+}
+
+void FTPControlPool::configure(const std::string &server, uint16_t port, const std::string &username,
+                               const std::string &password, size_t max_connections, uint32_t idle_timeout_ms) {
+  server_ = server;
+  port_ = port;
+  username_ = username;
+  password_ = password;
+  max_connections_ = max_connections < MAX_CONNECTIONS ? max_connections : MAX_CONNECTIONS;
+  idle_timeout_ms_ = idle_timeout_ms;
+}
+
+FTPControlConnection *FTPControlPool::acquire() {
+  FTPControlConnection *idle = nullptr;
+  FTPControlConnection *chosen = nullptr;
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  for (size_t i = 0; i < max_connections_; i++) {
+    FTPControlConnection &connection = connections_[i];
+    if (connection.in_use) {
+      continue;
+    }
+    // Une connexion déjà ouverte est préférée à un emplacement vide
+    if (connection.sock >= 0) {
+      idle = &connection;
+      break;
+    }
+    if (chosen == nullptr) {
+      chosen = &connection;
+    }
+  }
+  if (idle != nullptr) {
+    chosen = idle;
+  }
+  if (chosen != nullptr) {
+    chosen->in_use = true;
+  }
+  xSemaphoreGive(lock_);
+
+  if (chosen == nullptr) {
+    ESP_LOGW(TAG, "Toutes les connexions FTP (%u) sont occupées", (unsigned) max_connections_);
+    return nullptr;
+  }
+
+  if (idle != nullptr) {
+    // Fermée par le serveur pendant l'inactivité ? Vérifiée sans échange tant qu'elle est
+    // récente, par NOOP au-delà
+    bool healthy = is_alive_(idle->sock);
+    if (healthy && millis() - idle->last_used >= HEALTH_CHECK_AFTER_MS) {
+      char reply[128];
+      healthy = command(idle->sock, "NOOP", reply, sizeof(reply)) == 200;
+    }
+    if (healthy) {
+      return idle;
+    }
+    ESP_LOGD(TAG, "Connexion FTP inactive perdue, reconnexion");
+    close_connection_(idle->sock, false);
+    idle->sock = -1;
+  }
+
+  // Emplacement libre ou connexion perdue : nouvelle connexion, hors du verrou
+  chosen->sock = open_connection_();
+  if (chosen->sock < 0) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    chosen->in_use = false;
+    xSemaphoreGive(lock_);
+    return nullptr;
+  }
+  return chosen;
+}
+
+void FTPControlPool::release(FTPControlConnection *connection, bool reusable) {
+  if (connection == nullptr) {
+    return;
+  }
+  if (!reusable && connection->sock >= 0) {
+    close_connection_(connection->sock, true);
+    connection->sock = -1;
+  }
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  connection->last_used = millis();
+  connection->in_use = false;
+  xSemaphoreGive(lock_);
+}
+
+void FTPControlPool::evict_idle(uint32_t now) {
+  int expired[MAX_CONNECTIONS];
+  size_t count = 0;
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  for (auto &connection : connections_) {
+    if (!connection.in_use && connection.sock >= 0 && now - connection.last_used > idle_timeout_ms_) {
+      expired[count++] = connection.sock;
+      connection.sock = -1;
+    }
+  }
+  xSemaphoreGive(lock_);
+  for (size_t i = 0; i < count; i++) {
+    ESP_LOGD(TAG, "Fermeture d'une connexion FTP inactive");
+    close_connection_(expired[i], true);
+  }
+}
+
+bool FTPControlPool::resolve_() {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result = nullptr;
+  if (getaddrinfo(server_.c_str(), nullptr, &hints, &result) != 0 || result == nullptr) {
+    ESP_LOGE(TAG, "Échec de la résolution DNS de %s", server_.c_str());
+    return false;
+  }
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  memcpy(&address_, result->ai_addr, sizeof(address_));
+  address_.sin_port = htons(port_);
+  resolved_ = true;
+  xSemaphoreGive(lock_);
+  freeaddrinfo(result);
+  return true;
+}
+
+int FTPControlPool::open_connection_() {
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  bool resolved = resolved_;
+  xSemaphoreGive(lock_);
+  if (!resolved && !resolve_()) {
+    return -1;
+  }
+  struct sockaddr_in address;
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  address = address_;
+  xSemaphoreGive(lock_);
+
+  int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Échec de création du socket : %d", errno);
+    return -1;
+  }
+  int flag = 1;
+  setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+  // Commandes courtes en aller-retour : pas d'attente de Nagle
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  struct timeval timeout = {.tv_sec = REPLY_TIMEOUT_S, .tv_usec = 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (::connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    ESP_LOGE(TAG, "Échec de connexion FTP : %d", errno);
+    ::close(sock);
+    // L'adresse a pu changer : nouvelle résolution à la prochaine tentative
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    resolved_ = false;
+    xSemaphoreGive(lock_);
+    return -1;
+  }
+
+  char reply[256];
+  char cmd[160];
+  if (read_reply(sock, reply, sizeof(reply)) != 220) {
+    ESP_LOGE(TAG, "Message de bienvenue FTP non reçu");
+    close_connection_(sock, false);
+    return -1;
+  }
+  snprintf(cmd, sizeof(cmd), "USER %s", username_.c_str());
+  int code = command(sock, cmd, reply, sizeof(reply));
+  if (code == 331) {
+    snprintf(cmd, sizeof(cmd), "PASS %s", password_.c_str());
+    code = command(sock, cmd, reply, sizeof(reply));
+  }
+  if (code != 230) {
+    ESP_LOGE(TAG, "Authentification FTP refusée (%d)", code);
+    close_connection_(sock, true);
+    return -1;
+  }
+  if (command(sock, "TYPE I", reply, sizeof(reply)) != 200) {
+    ESP_LOGE(TAG, "Mode binaire refusé");
+    close_connection_(sock, true);
+    return -1;
+  }
+  ESP_LOGD(TAG, "Nouvelle connexion FTP authentifiée");
+  return sock;
+}
+
+int FTPControlPool::command(int sock, const char *cmd, char *reply, size_t reply_size) {
+  char line[256];
+  int len = snprintf(line, sizeof(line), "%s\r\n", cmd);
+  if (len <= 0 || static_cast<size_t>(len) >= sizeof(line) || send(sock, line, len, 0) != len) {
+    return -1;
+  }
+  return read_reply(sock, reply, reply_size);
+}
+
+int FTPControlPool::read_reply(int sock, char *reply, size_t reply_size) {
+  // Lecture par MSG_PEEK : seuls les octets de cette réponse sont consommés. Le 226 d'un
+  // petit fichier, arrivé dans le même segment que le 150, reste ainsi dans le socket.
+  uint32_t started = millis();
+  while (millis() - started < REPLY_TIMEOUT_S * 1000u) {
+    int n = recv(sock, reply, reply_size - 1, MSG_PEEK);
+    if (n <= 0) {
+      return -1;
+    }
+    size_t line = 0;
+    while (true) {
+      const char *eol = static_cast<const char *>(memchr(reply + line, '\n', n - line));
+      if (eol == nullptr) {
+        break;
+      }
+      size_t end = eol - reply + 1;
+      // Ligne finale "ddd texte" ; les lignes "ddd-" et intermédiaires sont sautées
+      if (end - line >= 4 && isdigit((unsigned char) reply[line]) && isdigit((unsigned char) reply[line + 1]) &&
+          isdigit((unsigned char) reply[line + 2]) && reply[line + 3] == ' ') {
+        int code = atoi(reply + line);
+        recv(sock, reply, end, 0);
+        reply[end] = '\0';
+        return code;
+      }
+      line = end;
+    }
+    if (line > 0) {
+      recv(sock, reply, line, 0);
+    } else if (static_cast<size_t>(n) == reply_size - 1) {
+      // Ligne plus longue que le tampon : son début est abandonné
+      recv(sock, reply, n, 0);
+    } else {
+      // Fin de ligne pas encore reçue
+      vTaskDelay(pdMS_TO_TICKS(5));
+    }
+  }
+  return -1;
+}
+
+bool FTPControlPool::is_alive_(int sock) {
+  char c;
+  int n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  // 0 : fermée par le serveur ; des octets en attente (421 d'expiration...) : inutilisable
+  return n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN);
+}
+
+void FTPControlPool::close_connection_(int sock, bool quit) {
+  if (quit) {
+    send(sock, "QUIT\r\n", 6, MSG_DONTWAIT);
+  }
+  ::close(sock);
+}
+
+}  // namespace ftp_http_proxy
+}  // namespace esphome
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <lwip/sockets.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+namespace esphome {
+namespace ftp_http_proxy {
+
+// Connexion de contrôle empruntée au pool : socket authentifié, en TYPE I
+struct FTPControlConnection {
+  int sock{-1};
+  uint32_t last_used{0};  // millis() du dernier rendu au pool
+  bool in_use{false};
+};
+
+// Pool borné de connexions de contrôle déjà connectées et authentifiées auprès du serveur
+// FTP amont. Un téléchargement emprunte une connexion prête au lieu de refaire DNS, TCP,
+// bannière, USER, PASS et TYPE I. Partagé entre les tâches du serveur HTTP (acquire/release)
+// et loop() (evict_idle) : toutes les opérations sur les emplacements sont sous mutex.
+class FTPControlPool {
+ public:
+  static const size_t MAX_CONNECTIONS = 4;
+  // Au-delà de ce délai d'inactivité, une connexion est vérifiée par NOOP avant d'être prêtée
+  static const uint32_t HEALTH_CHECK_AFTER_MS = 5000;
+  // Délai de réponse du serveur amont sur la connexion de contrôle
+  static const int REPLY_TIMEOUT_S = 5;
+
+  FTPControlPool();
+  ~FTPControlPool();
+
+  void configure(const std::string &server, uint16_t port, const std::string &username,
+                 const std::string &password, size_t max_connections, uint32_t idle_timeout_ms);
+
+  // Emprunte une connexion prête, en ouvre une nouvelle si le pool n'est pas plein ;
+  // nullptr si aucune n'est disponible ou si la connexion au serveur échoue
+  FTPControlConnection *acquire();
+  // Rend une connexion ; reusable à faux la ferme (erreur, transfert interrompu)
+  void release(FTPControlConnection *connection, bool reusable);
+  // Ferme les connexions inutilisées depuis plus de idle_timeout ; appelé depuis loop()
+  void evict_idle(uint32_t now);
+
+  // Envoie une commande (sans CRLF) et lit la réponse complète ; code FTP, -1 sur erreur réseau
+  static int command(int sock, const char *cmd, char *reply, size_t reply_size);
+  // Lit une réponse complète, multi-lignes comprises ; code FTP, -1 sur erreur réseau
+  static int read_reply(int sock, char *reply, size_t reply_size);
+
+ protected:
+  int open_connection_();
+  bool resolve_();
+  static bool is_alive_(int sock);
+  static void close_connection_(int sock, bool quit);
+
+  std::string server_;
+  uint16_t port_{21};
+  std::string username_;
+  std::string password_;
+  size_t max_connections_{2};
+  uint32_t idle_timeout_ms_{30000};
+
+  struct sockaddr_in address_{};  // adresse résolue une fois, relue après un échec de connexion
+  bool resolved_{false};
+  FTPControlConnection connections_[MAX_CONNECTIONS];
+  SemaphoreHandle_t lock_{nullptr};
+};
+
+}  // namespace ftp_http_proxy
+}  // namespace esphome
@@ -3,6 +3,8 @@
 #include "esp_log.h"
 #include <lwip/sockets.h>
 #include <netdb.h>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
 #include <arpa/inet.h>
 #include "esp_task_wdt.h"
@@ -26,85 +28,177 @@ void FTPHTTPProxy::setup() {
   ESP_LOGI(TAG, "Initialisation du proxy FTP/HTTP");
 
   // Aucune configuration du watchdog n'est effectuée ici
-  
+  pool_.configure(ftp_server_, ftp_port_, username_, password_, max_connections_, idle_timeout_);
+  download_slots_ = xSemaphoreCreateCounting(max_downloads_, max_downloads_);
+
   this->setup_http_server();
 }
 
 
-void FTPHTTPProxy::loop() {}
+void FTPHTTPProxy::loop() {
+  // Fermeture des connexions FTP inutilisées, au plus une fois par seconde
+  uint32_t now = millis();
+  if (now - last_eviction_ >= 1000) {
+    last_eviction_ = now;
+    pool_.evict_idle(now);
+  }
+}
 
-bool FTPHTTPProxy::connect_to_ftp() {
-  struct hostent *ftp_host = gethostbyname(ftp_server_.c_str());
-  if (!ftp_host) {
-    ESP_LOGE(TAG, "Échec de la résolution DNS");
+// "bytes=a-b", "bytes=a-" ou "bytes=-n" ; faux pour une syntaxe inconnue ou plusieurs
+// plages, la requête est alors servie en entier
+static bool parse_range(const char *value, HTTPRange &range) {
+  if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != nullptr) {
     return false;
   }
-
-  sock_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (sock_ < 0) {
-    ESP_LOGE(TAG, "Échec de création du socket : %d", errno);
+  const char *p = value + 6;
+  char *end;
+  if (*p == '-') {
+    if (!isdigit((unsigned char) p[1])) {
+      return false;
+    }
+    range.suffix = true;
+    range.first = strtoull(p + 1, &end, 10);
+  } else {
+    if (!isdigit((unsigned char) *p)) {
+      return false;
+    }
+    range.first = strtoull(p, &end, 10);
+    if (*end != '-') {
+      return false;
+    }
+    if (isdigit((unsigned char) end[1])) {
+      range.last = strtoull(end + 1, &end, 10);
+      if (range.last < range.first) {
+        return false;
+      }
+    } else {
+      end++;
+    }
+  }
+  if (*end != '\0') {
     return false;
   }
+  range.requested = true;
+  return true;
+}
 
-  // Configuration du socket pour être plus robuste
-  int flag = 1;
-  setsockopt(sock_, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
-  
-  // Augmenter la taille du buffer de réception
-  int rcvbuf = 32768;
-  setsockopt(sock_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
-
-  struct sockaddr_in server_addr;
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(21);
-  server_addr.sin_addr.s_addr = *((unsigned long *)ftp_host->h_addr);
-
-  if (::connect(sock_, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
-    ESP_LOGE(TAG, "Échec de connexion FTP : %d", errno);
-    ::close(sock_);
-    sock_ = -1;
-    return false;
+// SIZE, PASV, connexion de données, REST et RETR sur une connexion de contrôle empruntée.
+// retry indique un échec réseau (connexion à remplacer) plutôt qu'un refus du serveur.
+int FTPHTTPProxy::open_transfer(int ctrl, const std::string &remote_path, const HTTPRange &range,
+                                TransferWindow &window, bool &retry) {
+  char reply[256];
+  int ip[4], port[2];
+  int code;
+  retry = false;
+  window = TransferWindow();
+
+  if (range.requested) {
+    // La taille du fichier est nécessaire pour Content-Range et les plages "-n"
+    std::string size_cmd = "SIZE " + remote_path;
+    code = FTPControlPool::command(ctrl, size_cmd.c_str(), reply, sizeof(reply));
+    if (code < 0) {
+      retry = true;
+      return -1;
+    }
+    if (code != 213) {
+      ESP_LOGW(TAG, "Taille inconnue (%d), plage ignorée", code);
+    } else {
+      uint64_t total = strtoull(reply + 4, nullptr, 10);
+      uint64_t first = range.first;
+      uint64_t last = range.last < total ? range.last : total - 1;
+      if (range.suffix) {
+        first = range.first < total ? total - range.first : 0;
+        last = total - 1;
+      }
+      if (total == 0 || first >= total || (range.suffix && range.first == 0)) {
+        window.total = total;
+        return RANGE_NOT_SATISFIABLE;
+      }
+      window.partial = true;
+      window.offset = first;
+      window.total = total;
+      // Jusqu'à la fin : le transfert s'arrête de lui-même
+      window.length = last == total - 1 ? UINT64_MAX : last - first + 1;
+    }
   }
 
-  char buffer[256];
-  int bytes_received = recv(sock_, buffer, sizeof(buffer) - 1, 0);
-  if (bytes_received <= 0 || !strstr(buffer, "220 ")) {
-    ESP_LOGE(TAG, "Message de bienvenue FTP non reçu");
-    ::close(sock_);
-    sock_ = -1;
-    return false;
+  code = FTPControlPool::command(ctrl, "PASV", reply, sizeof(reply));
+  if (code != 227) {
+    retry = code < 0;
+    ESP_LOGE(TAG, "Erreur en mode passif (%d)", code);
+    return -1;
   }
-  buffer[bytes_received] = '\0';
+  const char *pasv_start = strchr(reply, '(');
+  if (!pasv_start ||
+      sscanf(pasv_start, "(%d,%d,%d,%d,%d,%d)", &ip[0], &ip[1], &ip[2], &ip[3], &port[0], &port[1]) != 6) {
+    ESP_LOGE(TAG, "Format PASV incorrect");
+    return -1;
+  }
+  int data_port = port[0] * 256 + port[1];
+  ESP_LOGD(TAG, "Port de données: %d", data_port);
 
-  // Authentification
-  snprintf(buffer, sizeof(buffer), "USER %s\r\n", username_.c_str());
-  send(sock_, buffer, strlen(buffer), 0);
-  bytes_received = recv(sock_, buffer, sizeof(buffer) - 1, 0);
-  buffer[bytes_received] = '\0';
+  int data_sock = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (data_sock < 0) {
+    ESP_LOGE(TAG, "Échec de création du socket de données");
+    return -1;
+  }
+  int flag = 1;
+  int rcvbuf = 32768;
+  setsockopt(data_sock, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+  setsockopt(data_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  // Sans délai, un serveur bloqué retiendrait pour toujours la tâche, son jeton de
+  // téléchargement et la connexion de contrôle empruntée
+  struct timeval stall_timeout = {.tv_sec = DATA_STALL_TIMEOUT_S, .tv_usec = 0};
+  setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, &stall_timeout, sizeof(stall_timeout));
 
-  snprintf(buffer, sizeof(buffer), "PASS %s\r\n", password_.c_str());
-  send(sock_, buffer, strlen(buffer), 0);
-  bytes_received = recv(sock_, buffer, sizeof(buffer) - 1, 0);
-  buffer[bytes_received] = '\0';
+  struct sockaddr_in data_addr;
+  memset(&data_addr, 0, sizeof(data_addr));
+  data_addr.sin_family = AF_INET;
+  data_addr.sin_port = htons(data_port);
+  data_addr.sin_addr.s_addr = htonl((ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | ip[3]);
+  if (::connect(data_sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) != 0) {
+    ESP_LOGE(TAG, "Échec de connexion au port de données");
+    ::close(data_sock);
+    retry = true;
+    return -1;
+  }
 
-  // Mode binaire
-  send(sock_, "TYPE I\r\n", 8, 0);
-  bytes_received = recv(sock_, buffer, sizeof(buffer) - 1, 0);
-  buffer[bytes_received] = '\0';
+  if (window.offset > 0) {
+    char rest[32];
+    snprintf(rest, sizeof(rest), "REST %llu", (unsigned long long) window.offset);
+    code = FTPControlPool::command(ctrl, rest, reply, sizeof(reply));
+    if (code != 350) {
+      retry = code < 0;
+      ESP_LOGE(TAG, "Reprise refusée par le serveur (%d)", code);
+      ::close(data_sock);
+      return -1;
+    }
+  }
 
-  return true;
+  std::string retr = "RETR " + remote_path;
+  code = FTPControlPool::command(ctrl, retr.c_str(), reply, sizeof(reply));
+  if (code != 150 && code != 125) {
+    retry = code < 0;
+    ESP_LOGE(TAG, "Fichier non trouvé ou inaccessible (%d)", code);
+    ::close(data_sock);
+    return -1;
+  }
+  return data_sock;
 }
 
-bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *req) {
+bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *req, const HTTPRange &range) {
   int data_sock = -1;
   bool success = false;
-  char *pasv_start = nullptr;
-  int data_port = 0;
-  int ip[4], port[2];
+  FTPControlConnection *connection = nullptr;
+  bool retry = false;
+  FTPStream stream;
+  CircularBuffer::Span span;
+  TransferWindow window;
+  uint64_t remaining;
+  bool cut_short = false;
+  char content_range[64];
+  char reply[256];
   int bytes_received;
-  int flag = 1;
-  int rcvbuf = 32768;
   int chunk_count = 0;
   size_t total_bytes_transferred = 0;
   size_t bytes_since_reset = 0;
@@ -141,8 +235,8 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
                       extension == ".bmp" || extension == ".gif" ||
                       extension == ".pdf" || extension == ".txt");
 
-  // Ajuster la taille du buffer pour optimiser les performances
-  // Pour les fichiers média, utiliser un buffer plus petit pour des réponses plus fréquentes
+  // Ajuster la taille des blocs pour optimiser les performances
+  // Pour les fichiers média, utiliser des blocs plus petits pour des réponses plus fréquentes
   int buffer_size;
   if (is_media_file) {
       buffer_size = 4096;
@@ -156,22 +250,41 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
       }
   }
 
- 
-
-  
-  // Allouer le buffer en SPIRAM
-  char* buffer = (char*)heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM);
-  if (!buffer) {
-    ESP_LOGE(TAG, "Échec d'allocation SPIRAM pour le buffer");
-    if (wdt_initialized) esp_task_wdt_delete(current_task);
-    return false;
-  }
-
   // Réinitialiser le watchdog avant des opérations potentiellement longues
   if (wdt_initialized) esp_task_wdt_reset();
 
-  if (!connect_to_ftp()) {
-    ESP_LOGE(TAG, "Échec de connexion FTP");
+  // Connexion authentifiée empruntée au pool ; si elle a été coupée entre-temps (erreur
+  // réseau sur PASV/RETR), elle est remplacée une fois de façon transparente
+  for (int attempt = 0; attempt < 2 && data_sock < 0; attempt++) {
+    connection = pool_.acquire();
+    if (connection == nullptr) {
+      ESP_LOGE(TAG, "Échec de connexion FTP");
+      goto error;
+    }
+    data_sock = open_transfer(connection->sock, remote_path, range, window, retry);
+    if (data_sock == RANGE_NOT_SATISFIABLE) {
+      // Aucun échange de données : la connexion reste utilisable
+      pool_.release(connection, true);
+      connection = nullptr;
+      ESP_LOGW(TAG, "Plage hors du fichier (%llu octets)", (unsigned long long) window.total);
+      snprintf(content_range, sizeof(content_range), "bytes */%llu", (unsigned long long) window.total);
+      httpd_resp_set_status(req, "416 Range Not Satisfiable");
+      httpd_resp_set_hdr(req, "Content-Range", content_range);
+      httpd_resp_send(req, nullptr, 0);
+      if (wdt_initialized) {
+        esp_task_wdt_delete(current_task);
+      }
+      return true;
+    }
+    if (data_sock < 0) {
+      pool_.release(connection, !retry);
+      connection = nullptr;
+      if (!retry) {
+        goto error;
+      }
+    }
+  }
+  if (data_sock < 0) {
     goto error;
   }
 
@@ -191,76 +304,43 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
     httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
   }
 
-  // Réinitialiser le watchdog avant des opérations de communication
-  if (wdt_initialized) esp_task_wdt_reset();
-
-  // Mode passif
-  send(sock_, "PASV\r\n", 6, 0);
-  bytes_received = recv(sock_, buffer, buffer_size - 1, 0);
-  if (bytes_received <= 0 || !strstr(buffer, "227 ")) {
-    ESP_LOGE(TAG, "Erreur en mode passif");
-    goto error;
+  // Plage : seuls les octets demandés sont lus, à partir de l'offset envoyé par REST
+  if (window.partial) {
+    uint64_t last = window.length == UINT64_MAX ? window.total - 1 : window.offset + window.length - 1;
+    snprintf(content_range, sizeof(content_range), "bytes %llu-%llu/%llu", (unsigned long long) window.offset,
+             (unsigned long long) last, (unsigned long long) window.total);
+    httpd_resp_set_status(req, "206 Partial Content");
+    httpd_resp_set_hdr(req, "Content-Range", content_range);
+    ESP_LOGI(TAG, "Plage demandée: %s", content_range);
   }
-  buffer[bytes_received] = '\0';
-  ESP_LOGD(TAG, "Réponse PASV: %s", buffer);
+  remaining = window.length;
 
-  pasv_start = strchr(buffer, '(');
-  if (!pasv_start) {
-    ESP_LOGE(TAG, "Format PASV incorrect");
-    goto error;
-  }
-  sscanf(pasv_start, "(%d,%d,%d,%d,%d,%d)", &ip[0], &ip[1], &ip[2], &ip[3], &port[0], &port[1]);
-  data_port = port[0] * 256 + port[1];
-  ESP_LOGD(TAG, "Port de données: %d", data_port);
-
-  // Réinitialiser le watchdog avant la création du socket
-  if (wdt_initialized) esp_task_wdt_reset();
-
-  data_sock = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (data_sock < 0) {
-    ESP_LOGE(TAG, "Échec de création du socket de données");
-    goto error;
-  }
-
-  setsockopt(data_sock, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
-  setsockopt(data_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
-
-  struct sockaddr_in data_addr;
-  memset(&data_addr, 0, sizeof(data_addr));
-  data_addr.sin_family = AF_INET;
-  data_addr.sin_port = htons(data_port);
-  data_addr.sin_addr.s_addr = htonl((ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | ip[3]);
-
-  // Réinitialiser le watchdog avant la connexion
+  // Réinitialiser le watchdog avant le transfert
   if (wdt_initialized) esp_task_wdt_reset();
 
-  if (::connect(data_sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) != 0) {
-    ESP_LOGE(TAG, "Échec de connexion au port de données");
-    goto error;
-  }
-
-  snprintf(buffer, buffer_size, "RETR %s\r\n", remote_path.c_str());
-  send(sock_, buffer, strlen(buffer), 0);
-
-  bytes_received = recv(sock_, buffer, buffer_size - 1, 0);
-  if (bytes_received <= 0 || !strstr(buffer, "150 ")) {
-    ESP_LOGE(TAG, "Fichier non trouvé ou inaccessible");
+  // Le socket de données est lu par une tâche dédiée : cette tâche ne fait plus qu'envoyer
+  // au client, les attentes amont et aval se recouvrent
+  if (!stream.start(data_sock, buffer_size)) {
     goto error;
   }
-  buffer[bytes_received] = '\0';
 
-  // Pour les fichiers média, envoyer en plus petits chunks avec plus de yields
+  // Pour les fichiers média, envoyer en plus petits chunks
   while (true) {
-    // Réinitialiser le watchdog plus fréquemment pour les fichiers volumineux
-    // Basé sur le volume de données transférées pour s'adapter à différentes vitesses
-    bytes_received = recv(data_sock, buffer, buffer_size, 0);
-    if (bytes_received <= 0) {
-      if (bytes_received < 0) {
-        ESP_LOGE(TAG, "Erreur de réception des données: %d", errno);
+    // Envoi direct depuis l'anneau, sans copie
+    span = stream.peek(1000);
+    if (span.size == 0) {
+      if (stream.finished()) {
+        break;
       }
-      break;
+      // Serveur FTP momentanément muet : le watchdog est tout de même nourri
+      if (wdt_initialized) esp_task_wdt_reset();
+      continue;
     }
-    
+    bytes_received = span.size < (size_t) buffer_size ? (int) span.size : buffer_size;
+    if ((uint64_t) bytes_received > remaining) {
+      bytes_received = (int) remaining;
+    }
+
     // Mise à jour des compteurs
     total_bytes_transferred += bytes_received;
     bytes_since_reset += bytes_received;
@@ -272,24 +352,33 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
       ESP_LOGD(TAG, "WDT reset après ~100 Ko, total transféré: %zu Ko", total_bytes_transferred / 1024);
     }
     
-    esp_err_t err = httpd_resp_send_chunk(req, buffer, bytes_received);
+    esp_err_t err = httpd_resp_send_chunk(req, (const char *) span.data, bytes_received);
     if (err != ESP_OK) {
       ESP_LOGE(TAG, "Échec d'envoi au client: %d", err);
       goto error;
     }
+    stream.consume(bytes_received);
+    if (remaining != UINT64_MAX) {
+      remaining -= bytes_received;
+      if (remaining == 0) {
+        // Fin de la plage avant la fin du fichier : la lecture amont est interrompue
+        cut_short = true;
+        break;
+      }
+    }
     
     // Comptez les chunks pour les fichiers média pour surveiller la progression
     chunk_count++;
     if (is_media_file && (chunk_count % 100 == 0)) {
       ESP_LOGD(TAG, "Streaming média: %d chunks envoyés, %zu Ko", chunk_count, total_bytes_transferred / 1024);
     }
-    
-    // Yield plus souvent pour les fichiers média, mais avec un délai plus court
-    if (is_media_file) {
-      vTaskDelay(pdMS_TO_TICKS(2));  // Délai minimal
-    } else {
-      vTaskDelay(pdMS_TO_TICKS(2));
-    }
+  }
+
+  stream.stop();
+  if (stream.error() != 0) {
+    // Délai dépassé (EAGAIN) ou connexion coupée : fichier tronqué, contrôle dans un état inconnu
+    ESP_LOGE(TAG, "Erreur de réception des données: %d", stream.error());
+    goto error;
   }
 
   // Réinitialiser le watchdog après la boucle principale
@@ -298,20 +387,18 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
   ::close(data_sock);
   data_sock = -1;
 
-  bytes_received = recv(sock_, buffer, buffer_size - 1, 0);
-  if (bytes_received > 0 && strstr(buffer, "226 ")) {
+  // Connexion rendue au pool seulement si le transfert s'est terminé proprement. Après
+  // une plage coupée, le serveur peut encore répondre 426 ou 226 : la connexion est
+  // fermée plutôt que de deviner combien de réponses restent à lire.
+  if (cut_short) {
     success = true;
-    buffer[bytes_received] = '\0';
-    ESP_LOGD(TAG, "Transfert terminé: %s", buffer);
+    pool_.release(connection, false);
+  } else {
+    success = FTPControlPool::read_reply(connection->sock, reply, sizeof(reply)) == 226;
+    pool_.release(connection, success);
   }
+  connection = nullptr;
 
-  send(sock_, "QUIT\r\n", 6, 0);
-  ::close(sock_);
-  sock_ = -1;
-
-  // Libérer le buffer SPIRAM
-  heap_caps_free(buffer);
-  
   httpd_resp_send_chunk(req, NULL, 0);
   
   // Statistiques finales
@@ -325,13 +412,11 @@ bool FTPHTTPProxy::download_file(const std::string &remote_path, httpd_req_t *re
   return success;
 
 error:
-  if (buffer) heap_caps_free(buffer);
+  // Le producteur doit avoir quitté le socket de données avant sa fermeture
+  stream.stop();
   if (data_sock != -1) ::close(data_sock);
-  if (sock_ != -1) {
-    send(sock_, "QUIT\r\n", 6, 0);
-    ::close(sock_);
-    sock_ = -1;
-  }
+  // Transfert en cours ou état inconnu : la connexion de contrôle n'est pas réutilisable
+  pool_.release(connection, false);
   
   // Retirer la tâche du watchdog en cas d'erreur
   if (wdt_initialized) {
@@ -352,6 +437,42 @@ esp_err_t FTPHTTPProxy::http_req_handler(httpd_req_t *req) {
 
   ESP_LOGI(TAG, "Requête reçue: %s", requested_path.c_str());
 
+  const std::string *remote_path = nullptr;
+  for (const auto &configured_path : proxy->remote_paths_) {
+    if (requested_path == configured_path) {
+      remote_path = &configured_path;
+      break;
+    }
+  }
+  if (remote_path == nullptr) {
+    ESP_LOGW(TAG, "Fichier non trouvé: %s", requested_path.c_str());
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Fichier non trouvé");
+    return ESP_FAIL;
+  }
+
+  // Nombre de téléchargements simultanés borné : au-delà, le client est invité à réessayer
+  if (xSemaphoreTake(proxy->download_slots_, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Trop de téléchargements en cours (%u), requête refusée", (unsigned) proxy->max_downloads_);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_send(req, "Trop de téléchargements en cours", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+
+  auto *request = new DownloadRequest();
+  request->proxy = proxy;
+  request->remote_path = *remote_path;
+
+  // Lecteurs média : reprise au milieu du fichier par une plage d'octets
+  size_t range_len = httpd_req_get_hdr_value_len(req, "Range");
+  if (range_len > 0 && range_len < 64) {
+    char range_value[64];
+    if (httpd_req_get_hdr_value_str(req, "Range", range_value, sizeof(range_value)) == ESP_OK &&
+        !parse_range(range_value, request->range)) {
+      ESP_LOGW(TAG, "En-tête Range ignoré: %s", range_value);
+    }
+  }
+
   // Obtenir l'extension du fichier pour déterminer le type MIME
   std::string extension = "";
   size_t dot_pos = requested_path.find_last_of('.');
@@ -367,56 +488,64 @@ esp_err_t FTPHTTPProxy::http_req_handler(httpd_req_t *req) {
     filename = requested_path.substr(slash_pos + 1);
   }
 
-  // Définir les types MIME et headers selon le type de fichier
-  if (extension == ".mp3") {
-    httpd_resp_set_type(req, "application/octet-stream");
-    std::string header = "attachment; filename=\"" + filename + "\"";
-    httpd_resp_set_hdr(req, "Content-Disposition", header.c_str());
-    ESP_LOGD(TAG, "Configuré pour téléchargement MP3");
-  } else if (extension == ".wav") {
-    httpd_resp_set_type(req, "application/octet-stream");
-    std::string header = "attachment; filename=\"" + filename + "\"";
-    httpd_resp_set_hdr(req, "Content-Disposition", header.c_str());
-    ESP_LOGD(TAG, "Configuré pour téléchargement WAV");
-  } else if (extension == ".ogg") {
-    httpd_resp_set_type(req, "application/octet-stream");
-    std::string header = "attachment; filename=\"" + filename + "\"";
-    httpd_resp_set_hdr(req, "Content-Disposition", header.c_str());
-    ESP_LOGD(TAG, "Configuré pour téléchargement OGG");
-  } else if (extension == ".pdf") {
-    httpd_resp_set_type(req, "application/pdf");
+  // Définir les types MIME et headers selon le type de fichier ; les chaînes sont gardées
+  // dans le contexte de la requête, httpd ne conservant que les pointeurs
+  if (extension == ".pdf") {
+    request->content_type = "application/pdf";
   } else if (extension == ".jpg" || extension == ".jpeg") {
-    httpd_resp_set_type(req, "image/jpeg");
+    request->content_type = "image/jpeg";
   } else if (extension == ".png") {
-    httpd_resp_set_type(req, "image/png");
+    request->content_type = "image/png";
   } else {
-    // Type par défaut pour les fichiers inconnus
-    httpd_resp_set_type(req, "application/octet-stream");
-    std::string header = "attachment; filename=\"" + filename + "\"";
-    httpd_resp_set_hdr(req, "Content-Disposition", header.c_str());
-    ESP_LOGD(TAG, "Configuré pour téléchargement générique");
+    // MP3, WAV, OGG et fichiers inconnus : téléchargement
+    request->content_type = "application/octet-stream";
+    request->content_disposition = "attachment; filename=\"" + filename + "\"";
+  }
+
+  // Le transfert se poursuit dans sa propre tâche : le serveur HTTP reste libre de
+  // traiter les requêtes suivantes pendant ce temps
+  if (httpd_req_async_handler_begin(req, &request->req) != ESP_OK) {
+    ESP_LOGE(TAG, "Échec de la prise en charge asynchrone de la requête");
+    delete request;
+    xSemaphoreGive(proxy->download_slots_);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Échec du téléchargement");
+    return ESP_FAIL;
+  }
+  if (xTaskCreate(download_task, "ftp_proxy_dl", DOWNLOAD_TASK_STACK, request, 5, nullptr) != pdPASS) {
+    ESP_LOGE(TAG, "Échec de création de la tâche de téléchargement");
+    httpd_req_async_handler_complete(request->req);
+    delete request;
+    xSemaphoreGive(proxy->download_slots_);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Échec du téléchargement");
+    return ESP_FAIL;
   }
+  return ESP_OK;
+}
+
+void FTPHTTPProxy::download_task(void *arg) {
+  auto *request = static_cast<DownloadRequest *>(arg);
+  FTPHTTPProxy *proxy = request->proxy;
+  httpd_req_t *req = request->req;
 
+  httpd_resp_set_type(req, request->content_type.c_str());
+  if (!request->content_disposition.empty()) {
+    httpd_resp_set_hdr(req, "Content-Disposition", request->content_disposition.c_str());
+  }
   // Pour traiter les gros fichiers, on ajoute des en-têtes supplémentaires
   httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
-  
-  for (const auto &configured_path : proxy->remote_paths_) {
-    if (requested_path == configured_path) {
-      ESP_LOGI(TAG, "Téléchargement du fichier: %s", requested_path.c_str());
-      if (proxy->download_file(configured_path, req)) {
-        ESP_LOGI(TAG, "Téléchargement réussi");
-        return ESP_OK;
-      } else {
-        ESP_LOGE(TAG, "Échec du téléchargement");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Échec du téléchargement");
-        return ESP_FAIL;
-      }
-    }
+
+  ESP_LOGI(TAG, "Téléchargement du fichier: %s", request->remote_path.c_str());
+  if (proxy->download_file(request->remote_path, req, request->range)) {
+    ESP_LOGI(TAG, "Téléchargement réussi");
+  } else {
+    ESP_LOGE(TAG, "Échec du téléchargement");
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Échec du téléchargement");
   }
 
-  ESP_LOGW(TAG, "Fichier non trouvé: %s", requested_path.c_str());
-  httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Fichier non trouvé");
-  return ESP_FAIL;
+  httpd_req_async_handler_complete(req);
+  delete request;
+  xSemaphoreGive(proxy->download_slots_);
+  vTaskDelete(nullptr);
 }
 
 void FTPHTTPProxy::setup_http_server() {
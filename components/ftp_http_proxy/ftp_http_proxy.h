@@ -5,40 +5,86 @@
 #include <string>
 #include <esp_http_server.h>
 #include <lwip/sockets.h>
+#include "ftp_control_pool.h"
+#include "ftp_stream.h"
 
 namespace esphome {
 namespace ftp_http_proxy {
 
+// Plage demandée par l'en-tête HTTP Range ; une seule plage est prise en charge
+struct HTTPRange {
+  bool requested{false};
+  bool suffix{false};          // "bytes=-n" : les n derniers octets, n dans first
+  uint64_t first{0};
+  uint64_t last{UINT64_MAX};   // inclus ; UINT64_MAX jusqu'à la fin du fichier
+};
+
+// Portion du fichier réellement demandée au serveur FTP
+struct TransferWindow {
+  bool partial{false};         // réponse 206
+  uint64_t offset{0};          // envoyé par REST
+  uint64_t length{UINT64_MAX}; // UINT64_MAX jusqu'à la fin du fichier
+  uint64_t total{0};           // taille du fichier (SIZE), si partial
+};
+
 class FTPHTTPProxy : public Component {
  public:
   void set_ftp_server(const std::string &server) { ftp_server_ = server; }
+  void set_ftp_port(uint16_t port) { ftp_port_ = port; }
   void set_username(const std::string &username) { username_ = username; }
   void set_password(const std::string &password) { password_ = password; }
   void add_remote_path(const std::string &path) { remote_paths_.push_back(path); }
   void set_local_port(uint16_t port) { local_port_ = port; }
+  void set_max_connections(size_t max_connections) { max_connections_ = max_connections; }
+  void set_idle_timeout(uint32_t idle_timeout) { idle_timeout_ = idle_timeout; }
+  void set_max_downloads(size_t max_downloads) { max_downloads_ = max_downloads; }
 
   void setup() override;
   void loop() override;
   float get_setup_priority() const override { return esphome::setup_priority::AFTER_WIFI; }
 
   // Point d'entrée public pour démarrer un téléchargement
-  bool download_file(const std::string &remote_path, httpd_req_t *req);
+  bool download_file(const std::string &remote_path, httpd_req_t *req, const HTTPRange &range = HTTPRange());
 
  protected:
+  static const uint32_t DOWNLOAD_TASK_STACK = 8192;
+  // Retour de open_transfer : plage hors du fichier, à refuser par 416
+  static const int RANGE_NOT_SATISFIABLE = -2;
+  // Serveur amont muet sur la connexion de données : au-delà, le téléchargement est abandonné
+  static const int DATA_STALL_TIMEOUT_S = 30;
+
+  // Contexte propre à un téléchargement, possédé par sa tâche jusqu'à la fin de la réponse
+  struct DownloadRequest {
+    FTPHTTPProxy *proxy{nullptr};
+    httpd_req_t *req{nullptr};  // copie asynchrone de la requête HTTP
+    std::string remote_path;
+    HTTPRange range;
+    std::string content_type;
+    std::string content_disposition;
+  };
+
   std::string ftp_server_;
   std::string username_;
   std::string password_;
   std::vector<std::string> remote_paths_;
   uint16_t local_port_{8000};
   httpd_handle_t server_{nullptr};
-  int sock_{-1};
-  int ftp_port_ = 21;
-  bool send_ftp_command(const std::string &cmd, std::string &response);
+  uint16_t ftp_port_{21};
+  // Connexions de contrôle authentifiées, partagées par les requêtes HTTP
+  FTPControlPool pool_;
+  size_t max_connections_{3};
+  uint32_t idle_timeout_{30000};
+  uint32_t last_eviction_{0};
+  // Téléchargements simultanés : un jeton par tâche de téléchargement
+  size_t max_downloads_{3};
+  SemaphoreHandle_t download_slots_{nullptr};
 
-  bool connect_to_ftp();
+  int open_transfer(int ctrl, const std::string &remote_path, const HTTPRange &range, TransferWindow &window,
+                    bool &retry);
   bool download_file_impl(const std::string &remote_path, httpd_req_t *req);
   void setup_http_server();
   static esp_err_t http_req_handler(httpd_req_t *req);
+  static void download_task(void *arg);
 };
 
 }  // namespace ftp_http_proxy
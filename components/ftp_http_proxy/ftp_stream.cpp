@@ -0,0 +1,129 @@
+#include "ftp_stream.h"
+#include "esp_log.h"
+#include <cerrno>
+#include <lwip/sockets.h>
+
+namespace esphome {
+namespace ftp_http_proxy {
+
+static const char *TAG = "ftp_proxy";
+
+FTPStream::~FTPStream() {
+  stop();
+  delete ring_;
+  if (lock_ != nullptr) {
+    vSemaphoreDelete(lock_);
+  }
+  if (exited_ != nullptr) {
+    vSemaphoreDelete(exited_);
+  }
+}
+
+bool FTPStream::start(int data_sock, size_t chunk_size) {
+  sock_ = data_sock;
+  chunk_size_ = chunk_size;
+  consumer_ = xTaskGetCurrentTaskHandle();
+  ring_ = new CircularBuffer(RING_SIZE);
+  lock_ = xSemaphoreCreateMutex();
+  exited_ = xSemaphoreCreateBinary();
+  if (!ring_->valid() || lock_ == nullptr || exited_ == nullptr) {
+    ESP_LOGE(TAG, "Échec d'allocation du tampon de streaming");
+    return false;
+  }
+  if (xTaskCreate(producer_task, "ftp_proxy_rx", PRODUCER_STACK, this, uxTaskPriorityGet(nullptr), &producer_) !=
+      pdPASS) {
+    ESP_LOGE(TAG, "Échec de création de la tâche de lecture FTP");
+    producer_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void FTPStream::producer_task(void *arg) {
+  auto *stream = static_cast<FTPStream *>(arg);
+  stream->produce_();
+  // Le flux peut être détruit dès que exited_ est donné : plus aucun accès ensuite
+  xSemaphoreGive(stream->exited_);
+  vTaskDelete(nullptr);
+}
+
+void FTPStream::produce_() {
+  while (!stop_.load(std::memory_order_relaxed)) {
+    if (ring_->available() >= HIGH_WATERMARK) {
+      // Réveillé par le consommateur sous le seuil bas, ou par stop(). Le drapeau est
+      // publié avant de relire le niveau pour ne pas manquer un réveil.
+      producer_waiting_.store(true);
+      if (ring_->available() >= HIGH_WATERMARK) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+      }
+      producer_waiting_.store(false);
+      continue;
+    }
+
+    CircularBuffer::Span span = ring_->acquire_write_span();
+    int received = recv(sock_, span.data, span.size < chunk_size_ ? span.size : chunk_size_, 0);
+    if (received <= 0) {
+      if (received < 0 && !stop_.load(std::memory_order_relaxed)) {
+        error_.store(errno, std::memory_order_relaxed);
+      }
+      break;
+    }
+    ring_->commit(received);
+    if (consumer_waiting_.load()) {
+      xTaskNotifyGive(consumer_);
+    }
+  }
+
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  finished_.store(true);
+  xSemaphoreGive(lock_);
+  xTaskNotifyGive(consumer_);
+}
+
+CircularBuffer::Span FTPStream::peek(uint32_t timeout_ms) {
+  CircularBuffer::Span span = ring_->acquire_read_span();
+  if (span.size > 0 || finished_.load()) {
+    return span;
+  }
+  consumer_waiting_.store(true);
+  span = ring_->acquire_read_span();
+  if (span.size == 0 && !finished_.load()) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    span = ring_->acquire_read_span();
+  }
+  consumer_waiting_.store(false);
+  return span;
+}
+
+void FTPStream::consume(size_t count) {
+  ring_->release(count);
+  if (producer_waiting_.load() && ring_->available() <= LOW_WATERMARK) {
+    // Sous le verrou : un producteur qui n'a pas fini ne peut pas sortir entre-temps
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (!finished_.load() && producer_waiting_.exchange(false)) {
+      xTaskNotifyGive(producer_);
+    }
+    xSemaphoreGive(lock_);
+  }
+}
+
+bool FTPStream::finished() { return finished_.load() && ring_->isEmpty(); }
+
+void FTPStream::stop() {
+  if (producer_ == nullptr) {
+    return;
+  }
+  stop_.store(true, std::memory_order_relaxed);
+  xSemaphoreTake(lock_, portMAX_DELAY);
+  if (!finished_.load()) {
+    // Débloque un recv() en cours et une attente sur le seuil haut
+    ::shutdown(sock_, SHUT_RD);
+    xTaskNotifyGive(producer_);
+  }
+  xSemaphoreGive(lock_);
+  xSemaphoreTake(exited_, portMAX_DELAY);
+  producer_ = nullptr;
+}
+
+}  // namespace ftp_http_proxy
+}  // namespace esphome
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "circular_buffer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+namespace esphome {
+namespace ftp_http_proxy {
+
+// Pipeline FTP → HTTP en deux tâches : une tâche productrice lit le socket de données
+// dans un anneau en PSRAM pendant que la tâche du téléchargement le vide vers le client.
+// Un client lent n'arrête plus la lecture amont et inversement : le débit suit le lien
+// le plus lent au lieu de la somme des deux. Au-dessus du seuil haut, le producteur
+// cesse de lire (le contrôle de flux TCP ralentit le serveur FTP) jusqu'à ce que le
+// consommateur soit redescendu sous le seuil bas. recv() écrit directement dans l'anneau
+// et le consommateur envoie depuis l'anneau : aucune copie intermédiaire, aucun verrou
+// sur le chemin des données.
+class FTPStream {
+ public:
+  static const size_t RING_SIZE = 64 * 1024;
+  static const size_t HIGH_WATERMARK = RING_SIZE * 3 / 4;
+  static const size_t LOW_WATERMARK = RING_SIZE / 4;
+  static const uint32_t PRODUCER_STACK = 4096;
+
+  ~FTPStream();
+
+  // Démarre la lecture de data_sock par blocs de chunk_size octets, depuis la tâche
+  // consommatrice ; le socket reste la propriété de l'appelant
+  bool start(int data_sock, size_t chunk_size);
+  // Bloc contigu prêt à être envoyé ; attend au plus timeout_ms si l'anneau est vide.
+  // Vide avec finished() vrai : fin du flux.
+  CircularBuffer::Span peek(uint32_t timeout_ms);
+  // Rend les count premiers octets du dernier bloc, une fois envoyés
+  void consume(size_t count);
+  bool finished();
+  // errno de la dernière lecture amont en échec, 0 sur une fin normale
+  int error() const { return error_.load(std::memory_order_acquire); }
+  // Arrête le producteur (fin de flux ou abandon) et attend sa sortie ; idempotent
+  void stop();
+
+ protected:
+  static void producer_task(void *arg);
+  void produce_();
+
+  CircularBuffer *ring_{nullptr};
+  size_t chunk_size_{0};
+  int sock_{-1};
+  // Réveils d'un côté par l'autre, seulement quand il attend
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<bool> consumer_waiting_{false};
+  std::atomic<bool> finished_{false};
+  std::atomic<int> error_{0};
+  std::atomic<bool> stop_{false};
+  // Ne protège que la fin du producteur : personne ne le notifie après finished_
+  SemaphoreHandle_t lock_{nullptr};
+  SemaphoreHandle_t exited_{nullptr};
+  TaskHandle_t producer_{nullptr};
+  TaskHandle_t consumer_{nullptr};
+};
+
+}  // namespace ftp_http_proxy
+}  // namespace esphome
@@ -1,16 +1,74 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
+from esphome import automation
 from esphome.const import CONF_ID, CONF_PASSWORD, CONF_USERNAME, CONF_PORT
+from esphome.core import CORE
+from ..sd_mmc_card import SdMmc, CONF_SD_MMC_CARD_ID
 
 DEPENDENCIES = ['network']
 CODEOWNERS = ['@youkorr']
 
 # Définir les constantes pour la configuration
+CONF_FTP_SERVER_ID = 'ftp_server_id'
 CONF_ROOT_PATH = 'root_path'
+CONF_METRICS_INTERVAL = 'metrics_interval'
+CONF_LISTING_CACHE_SIZE = 'listing_cache_size'
+CONF_DOWNLOAD_BUFFER_COUNT = 'download_buffer_count'
+CONF_DOWNLOAD_BUFFER_SIZE = 'download_buffer_size'
+CONF_TRANSFER_WORKERS = 'transfer_workers'
+CONF_TRANSFER_WORKER_CORE = 'transfer_worker_core'
+CONF_TRANSFER_WORKER_PRIORITY = 'transfer_worker_priority'
+CONF_COMPRESSION_MEMORY = 'compression_memory'
+CONF_COMPRESSION_LEVEL = 'compression_level'
+CONF_PASSIVE_PORTS = 'passive_ports'
+CONF_BANDWIDTH = 'bandwidth'
+CONF_DOWNLOAD = 'download'
+CONF_UPLOAD = 'upload'
+CONF_SESSION_DOWNLOAD = 'session_download'
+CONF_SESSION_UPLOAD = 'session_upload'
+CONF_FAIR_SHARE = 'fair_share'
+CONF_TRACE_EVENTS = 'trace_events'
+CONF_FIRST = 'first'
+CONF_LAST = 'last'
+
+# Chaque port passif pré-ouvert occupe un socket lwIP en permanence
+MAX_PASSIVE_PORTS = 16
 
 # Créer l'espace de noms et la classe FTP
 ftp_ns = cg.esphome_ns.namespace('ftp_server')
 FTPServer = ftp_ns.class_('FTPServer', cg.Component)
+FTPDirection = ftp_ns.enum('FTPDirection')
+FTPServerSetBandwidthAction = ftp_ns.class_('FTPServerSetBandwidthAction', automation.Action)
+FTPServerDumpTraceAction = ftp_ns.class_('FTPServerDumpTraceAction', automation.Action)
+
+def validate_passive_ports(config):
+    count = config[CONF_LAST] - config[CONF_FIRST] + 1
+    if count < 1:
+        raise cv.Invalid("'last' doit être supérieur ou égal à 'first'")
+    if count > MAX_PASSIVE_PORTS:
+        raise cv.Invalid(f"Au plus {MAX_PASSIVE_PORTS} ports passifs")
+    return config
+
+PASSIVE_PORTS_SCHEMA = cv.All(cv.Schema({
+    cv.Required(CONF_FIRST): cv.port,
+    cv.Required(CONF_LAST): cv.port,
+}), validate_passive_ports)
+
+def validate_trace_events(value):
+    value = cv.int_range(min=16, max=4096)(value)
+    if value & (value - 1):
+        raise cv.Invalid("trace_events doit être une puissance de deux")
+    return value
+
+# Débits en octets par seconde, 0 : illimité
+BANDWIDTH_SCHEMA = cv.Schema({
+    cv.Optional(CONF_DOWNLOAD, default=0): cv.int_range(min=0),
+    cv.Optional(CONF_UPLOAD, default=0): cv.int_range(min=0),
+    cv.Optional(CONF_SESSION_DOWNLOAD, default=0): cv.int_range(min=0),
+    cv.Optional(CONF_SESSION_UPLOAD, default=0): cv.int_range(min=0),
+    # Répartit le débit global à parts égales entre les transferts actifs
+    cv.Optional(CONF_FAIR_SHARE, default=False): cv.boolean,
+})
 
 # Schéma de configuration
 CONFIG_SCHEMA = cv.Schema({
@@ -19,6 +77,30 @@ CONFIG_SCHEMA = cv.Schema({
     cv.Required(CONF_PASSWORD): cv.string,
     cv.Optional(CONF_ROOT_PATH, default='/sdcard'): cv.string,
     cv.Optional(CONF_PORT, default=21): cv.port,
+    # Taille maximale des listings gardés en mémoire, 0 pour désactiver le cache
+    cv.Optional(CONF_LISTING_CACHE_SIZE, default=32768): cv.int_range(min=0),
+    # Blocs remplis par la tâche de lecture pendant les RETR, 0 pour lire depuis loop()
+    cv.Optional(CONF_DOWNLOAD_BUFFER_COUNT, default=2): cv.int_range(min=0, max=8),
+    cv.Optional(CONF_DOWNLOAD_BUFFER_SIZE, default=32768): cv.int_range(min=2048, max=262144),
+    # Tâches exécutant les transferts hors de loop(), 0 pour tout traiter dans loop().
+    # Cœur -1 : pas d'affinité ; par défaut le cœur 0, loop() tournant sur le cœur 1
+    cv.Optional(CONF_TRANSFER_WORKERS, default=1): cv.int_range(min=0, max=4),
+    cv.Optional(CONF_TRANSFER_WORKER_CORE, default=0): cv.int_range(min=-1, max=1),
+    cv.Optional(CONF_TRANSFER_WORKER_PRIORITY, default=5): cv.int_range(min=1, max=20),
+    # MODE Z : mémoire totale des flux zlib (un flux de compression occupe ~320 Ko), 0 pour désactiver
+    cv.Optional(CONF_COMPRESSION_MEMORY, default=393216): cv.int_range(min=0),
+    cv.Optional(CONF_COMPRESSION_LEVEL, default=6): cv.int_range(min=1, max=9),
+    # Plage de ports passifs gardés en écoute (pare-feu, latence des PASV) ; absente : ports éphémères
+    cv.Optional(CONF_PASSIVE_PORTS): PASSIVE_PORTS_SCHEMA,
+    # Limitation de débit par seau à jetons, globale et par session, dans chaque sens
+    cv.Optional(CONF_BANDWIDTH): BANDWIDTH_SCHEMA,
+    # Anneau de traces binaires (commandes, réponses, transferts), lu par ftp_server.dump_trace ;
+    # absent : le traçage n'est pas compilé
+    cv.Optional(CONF_TRACE_EVENTS): validate_trace_events,
+    # Période de publication des capteurs sensor/text_sensor de ftp_server
+    cv.Optional(CONF_METRICS_INTERVAL, default='10s'): cv.positive_time_period_milliseconds,
+    # Carte SD dont les écritures doivent invalider le cache des listings
+    cv.Optional(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
 }).extend(cv.COMPONENT_SCHEMA)
 
 async def to_code(config):
@@ -30,13 +112,69 @@ async def to_code(config):
     cg.add(var.set_password(config[CONF_PASSWORD]))
     cg.add(var.set_root_path(config[CONF_ROOT_PATH]))
     cg.add(var.set_port(config[CONF_PORT]))
+    cg.add(var.set_listing_cache_size(config[CONF_LISTING_CACHE_SIZE]))
+    cg.add(var.set_download_buffer_count(config[CONF_DOWNLOAD_BUFFER_COUNT]))
+    cg.add(var.set_download_buffer_size(config[CONF_DOWNLOAD_BUFFER_SIZE]))
+    cg.add(var.set_transfer_workers(config[CONF_TRANSFER_WORKERS]))
+    cg.add(var.set_transfer_worker_core(config[CONF_TRANSFER_WORKER_CORE]))
+    cg.add(var.set_transfer_worker_priority(config[CONF_TRANSFER_WORKER_PRIORITY]))
+    cg.add(var.set_compression_memory(config[CONF_COMPRESSION_MEMORY]))
+    if CORE.is_host:
+        # Plateforme host (Linux/POSIX) : MODE Z sur la zlib du système à la place du miniz
+        # en ROM, MD5/SHA-256 par sa libmbedcrypto, les tâches sont des threads
+        cg.add_build_flag('-lz')
+        cg.add_build_flag('-lmbedcrypto')
+        cg.add_build_flag('-pthread')
+    cg.add(var.set_compression_level(config[CONF_COMPRESSION_LEVEL]))
+    cg.add(var.set_metrics_interval(config[CONF_METRICS_INTERVAL]))
+    if CONF_BANDWIDTH in config:
+        bandwidth = config[CONF_BANDWIDTH]
+        cg.add(var.set_global_rate(FTPDirection.FTP_DIRECTION_DOWNLOAD, bandwidth[CONF_DOWNLOAD]))
+        cg.add(var.set_global_rate(FTPDirection.FTP_DIRECTION_UPLOAD, bandwidth[CONF_UPLOAD]))
+        cg.add(var.set_session_rate(FTPDirection.FTP_DIRECTION_DOWNLOAD, bandwidth[CONF_SESSION_DOWNLOAD]))
+        cg.add(var.set_session_rate(FTPDirection.FTP_DIRECTION_UPLOAD, bandwidth[CONF_SESSION_UPLOAD]))
+        cg.add(var.set_fair_share(bandwidth[CONF_FAIR_SHARE]))
+    if CONF_TRACE_EVENTS in config:
+        cg.add_define("USE_FTP_SERVER_TRACE")
+        cg.add(var.set_trace_events(config[CONF_TRACE_EVENTS]))
+    if CONF_PASSIVE_PORTS in config:
+        ports = config[CONF_PASSIVE_PORTS]
+        cg.add(var.set_passive_ports(ports[CONF_FIRST], ports[CONF_LAST]))
 
+    if CONF_SD_MMC_CARD_ID in config:
+        card = await cg.get_variable(config[CONF_SD_MMC_CARD_ID])
+        cg.add_define("USE_FTP_SERVER_SD_MMC")
+        cg.add(var.set_sd_mmc_card(card))
 
 
+FTP_SERVER_SET_BANDWIDTH_ACTION_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.use_id(FTPServer),
+    cv.Optional(CONF_DOWNLOAD): cv.templatable(cv.uint32_t),
+    cv.Optional(CONF_UPLOAD): cv.templatable(cv.uint32_t),
+    cv.Optional(CONF_SESSION_DOWNLOAD): cv.templatable(cv.uint32_t),
+    cv.Optional(CONF_SESSION_UPLOAD): cv.templatable(cv.uint32_t),
+    cv.Optional(CONF_FAIR_SHARE): cv.templatable(cv.boolean),
+})
 
+@automation.register_action(
+    'ftp_server.set_bandwidth', FTPServerSetBandwidthAction, FTP_SERVER_SET_BANDWIDTH_ACTION_SCHEMA
+)
+async def ftp_server_set_bandwidth_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    for key in (CONF_DOWNLOAD, CONF_UPLOAD, CONF_SESSION_DOWNLOAD, CONF_SESSION_UPLOAD):
+        if key in config:
+            value = await cg.templatable(config[key], args, cg.uint32)
+            cg.add(getattr(var, f'set_{key}')(value))
+    if CONF_FAIR_SHARE in config:
+        value = await cg.templatable(config[CONF_FAIR_SHARE], args, bool)
+        cg.add(var.set_fair_share(value))
+    return var
 
 
-
-
-
-
+@automation.register_action(
+    'ftp_server.dump_trace', FTPServerDumpTraceAction, cv.Schema({cv.GenerateID(): cv.use_id(FTPServer)})
+)
+async def ftp_server_dump_trace_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
@@ -0,0 +1,63 @@
+#include "bandwidth_shaper.h"
+
+namespace esphome {
+namespace ftp_server {
+
+void BandwidthShaper::lock_() {
+  mutex_.lock();
+}
+
+void BandwidthShaper::unlock_() {
+  mutex_.unlock();
+}
+
+uint32_t BandwidthShaper::session_limit_(FTPDirection direction) const {
+  uint32_t limit = session_rate_[direction].load(std::memory_order_relaxed);
+  uint32_t global = global_rate_[direction].load(std::memory_order_relaxed);
+  uint32_t active = active_[direction].load(std::memory_order_relaxed);
+  if (fair_share_.load(std::memory_order_relaxed) && global > 0 && active > 0) {
+    uint32_t share = global / active;
+    if (share == 0) {
+      share = 1;
+    }
+    if (limit == 0 || share < limit) {
+      limit = share;
+    }
+  }
+  return limit;
+}
+
+uint32_t BandwidthShaper::delay_ms(TokenBucket &session_bucket, FTPDirection direction, uint32_t now) {
+  uint32_t delay = 0;
+  uint32_t limit = session_limit_(direction);
+  if (limit > 0) {
+    session_bucket.refill(limit, now);
+    delay = session_bucket.delay_ms(limit);
+  }
+
+  uint32_t global = global_rate_[direction].load(std::memory_order_relaxed);
+  if (global > 0) {
+    this->lock_();
+    global_bucket_[direction].refill(global, now);
+    uint32_t global_delay = global_bucket_[direction].delay_ms(global);
+    this->unlock_();
+    if (global_delay > delay) {
+      delay = global_delay;
+    }
+  }
+  return delay;
+}
+
+void BandwidthShaper::consume(TokenBucket &session_bucket, FTPDirection direction, uint32_t bytes) {
+  if (session_limit_(direction) > 0) {
+    session_bucket.consume(bytes);
+  }
+  if (global_rate_[direction].load(std::memory_order_relaxed) > 0) {
+    this->lock_();
+    global_bucket_[direction].consume(bytes);
+    this->unlock_();
+  }
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "ftp_tasks.h"
+
+namespace esphome {
+namespace ftp_server {
+
+enum FTPDirection : uint8_t {
+  FTP_DIRECTION_DOWNLOAD,  // serveur vers client : RETR et listings
+  FTP_DIRECTION_UPLOAD,    // client vers serveur : STOR et APPE
+};
+
+// Seau à jetons à découvert : un pas de transfert est autorisé tant que le solde est
+// positif, puis les octets réellement transférés sont débités, quitte à passer en négatif.
+// Les étapes n'ont donc pas à découper leurs envois selon le crédit disponible.
+class TokenBucket {
+ public:
+  // Crédit maximal accumulé : 250 ms de débit, au moins un bloc de transfert
+  static const uint32_t BURST_MS = 250;
+  static const int32_t MIN_BURST = 8192;
+
+  void reset() {
+    tokens_ = 0;
+    refilled_at_ = 0;
+    fresh_ = true;
+  }
+
+  void refill(uint32_t rate, uint32_t now) {
+    int32_t burst = static_cast<int32_t>(static_cast<uint64_t>(rate) * BURST_MS / 1000);
+    if (burst < MIN_BURST) {
+      burst = MIN_BURST;
+    }
+    if (fresh_) {
+      // Un transfert commence avec un crédit plein
+      tokens_ = burst;
+      fresh_ = false;
+    } else {
+      int64_t tokens = tokens_ + static_cast<int64_t>(rate) * (now - refilled_at_) / 1000;
+      tokens_ = tokens > burst ? burst : static_cast<int32_t>(tokens);
+    }
+    refilled_at_ = now;
+  }
+
+  // Délai avant que le solde redevienne positif, 0 si le pas peut avoir lieu
+  uint32_t delay_ms(uint32_t rate) const {
+    if (tokens_ > 0) {
+      return 0;
+    }
+    return static_cast<uint32_t>((static_cast<int64_t>(1 - tokens_) * 1000 + rate - 1) / rate);
+  }
+
+  void consume(uint32_t bytes) {
+    int64_t tokens = static_cast<int64_t>(tokens_) - bytes;
+    tokens_ = tokens < INT32_MIN ? INT32_MIN : static_cast<int32_t>(tokens);
+  }
+
+ protected:
+  int32_t tokens_{0};
+  uint32_t refilled_at_{0};
+  bool fresh_{true};
+};
+
+// Limites de débit par session et globales, pour chaque sens. Les limites sont modifiées
+// depuis loop() (actions) et lues par les tâches de travail : atomiques 32 bits. Les seaux
+// globaux sont partagés entre toutes les tâches et protégés par un mutex.
+class BandwidthShaper {
+ public:
+  // Débits en octets par seconde, 0 : illimité
+  void set_global_rate(FTPDirection direction, uint32_t rate) { global_rate_[direction].store(rate); }
+  void set_session_rate(FTPDirection direction, uint32_t rate) { session_rate_[direction].store(rate); }
+  // Partage équitable : chaque transfert actif est limité à sa part du débit global
+  void set_fair_share(bool fair_share) { fair_share_.store(fair_share); }
+  uint32_t get_global_rate(FTPDirection direction) const { return global_rate_[direction].load(); }
+  uint32_t get_session_rate(FTPDirection direction) const { return session_rate_[direction].load(); }
+  bool get_fair_share() const { return fair_share_.load(); }
+
+  // Transferts actifs de chaque sens, pour le calcul des parts équitables
+  void begin_transfer(FTPDirection direction) { active_[direction].fetch_add(1); }
+  void end_transfer(FTPDirection direction) { active_[direction].fetch_sub(1); }
+
+  // Délai avant le prochain pas du transfert qui possède session_bucket, 0 s'il peut avoir lieu
+  uint32_t delay_ms(TokenBucket &session_bucket, FTPDirection direction, uint32_t now);
+  // Débite les octets transférés pendant le pas
+  void consume(TokenBucket &session_bucket, FTPDirection direction, uint32_t bytes);
+
+ protected:
+  uint32_t session_limit_(FTPDirection direction) const;
+  void lock_();
+  void unlock_();
+
+  std::atomic<uint32_t> global_rate_[2]{};
+  std::atomic<uint32_t> session_rate_[2]{};
+  std::atomic<bool> fair_share_{false};
+  std::atomic<uint32_t> active_[2]{};
+  TokenBucket global_bucket_[2];
+  FTPMutex mutex_;
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <utility>
+
+#include "file_hash.h"
+
+namespace esphome {
+namespace ftp_server {
+
+// Empreintes déjà calculées, par chemin et algorithme. Une entrée n'est valable que si la
+// taille et la date de modification du fichier n'ont pas changé depuis le calcul.
+class DigestCache {
+ public:
+  static const size_t MAX_ENTRIES = 32;
+
+  bool find(const std::string &path, HashAlgorithm algorithm, uint64_t size, int64_t mtime, std::string &digest) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->algorithm == algorithm && it->path == path) {
+        if (it->size != size || it->mtime != mtime) {
+          entries_.erase(it);
+          return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it);
+        digest = entries_.front().digest;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void insert(const std::string &path, HashAlgorithm algorithm, uint64_t size, int64_t mtime, std::string digest) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->algorithm == algorithm && it->path == path) {
+        entries_.erase(it);
+        break;
+      }
+    }
+    if (entries_.size() >= MAX_ENTRIES) {
+      entries_.pop_back();
+    }
+    entries_.push_front(Entry{path, algorithm, size, mtime, std::move(digest)});
+  }
+
+  // Toutes les empreintes d'un fichier réécrit, renommé ou supprimé
+  void invalidate(const std::string &path) {
+    entries_.remove_if([&path](const Entry &entry) { return entry.path == path; });
+  }
+
+ protected:
+  struct Entry {
+    std::string path;
+    HashAlgorithm algorithm;
+    uint64_t size;
+    int64_t mtime;
+    std::string digest;
+  };
+
+  std::list<Entry> entries_;
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,157 @@
+#include "download_pipeline.h"
+#include "ftp_platform.h"
+#include <unistd.h>
+#include <errno.h>
+
+namespace esphome {
+namespace ftp_server {
+
+static const char *TAG = "ftp_pipeline";
+
+DownloadPipeline::~DownloadPipeline() {
+  this->stop();
+  this->release_();
+}
+
+void DownloadPipeline::lock_() {
+  mutex_.lock();
+}
+
+void DownloadPipeline::unlock_() {
+  mutex_.unlock();
+}
+
+bool DownloadPipeline::allocate(size_t count, size_t size) {
+  // Sous verrou : la tâche de lecture parcourt les blocs de toutes les sessions
+  this->lock_();
+  if (!blocks_.empty()) {
+    this->unlock_();
+    return true;
+  }
+  blocks_.resize(count);
+  for (Block &block : blocks_) {
+    block.data = static_cast<char *>(heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+    if (block.data == nullptr) {
+      block.data = static_cast<char *>(heap_caps_malloc(size, MALLOC_CAP_8BIT));
+      internal_ram_ = true;
+    }
+    if (block.data == nullptr) {
+      ESP_LOGW(TAG, "Failed to allocate %u download buffers of %u bytes", (unsigned) count, (unsigned) size);
+      this->release_();
+      this->unlock_();
+      return false;
+    }
+  }
+  block_size_ = size;
+  this->unlock_();
+  return true;
+}
+
+void DownloadPipeline::release() {
+  this->lock_();
+  this->release_();
+  this->unlock_();
+}
+
+void DownloadPipeline::release_() {
+  for (Block &block : blocks_) {
+    if (block.data != nullptr) {
+      heap_caps_free(block.data);
+    }
+  }
+  blocks_.clear();
+  block_size_ = 0;
+  internal_ram_ = false;
+}
+
+void DownloadPipeline::start(int fd) {
+  this->lock_();
+  fd_ = fd;
+  head_pos_ = 0;
+  eof_.store(false);
+  failed_.store(false);
+  produced_.store(0);
+  consumed_.store(0);
+  active_.store(true, std::memory_order_release);
+  this->unlock_();
+}
+
+void DownloadPipeline::stop() {
+  // Le verrou est tenu par fill() pendant read() : une fois acquis, plus aucun accès à fd_
+  this->lock_();
+  active_.store(false, std::memory_order_release);
+  fd_ = -1;
+  this->unlock_();
+}
+
+bool DownloadPipeline::peek(const char *&data, size_t &len) const {
+  uint32_t consumed = consumed_.load(std::memory_order_relaxed);
+  if (consumed == produced_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  const Block &block = blocks_[consumed % blocks_.size()];
+  data = block.data + head_pos_;
+  len = block.len - head_pos_;
+  return true;
+}
+
+bool DownloadPipeline::consume(size_t len) {
+  uint32_t consumed = consumed_.load(std::memory_order_relaxed);
+  head_pos_ += len;
+  if (head_pos_ < blocks_[consumed % blocks_.size()].len) {
+    return false;
+  }
+  head_pos_ = 0;
+  consumed_.store(consumed + 1, std::memory_order_release);
+  return true;
+}
+
+bool DownloadPipeline::is_finished() const {
+  return eof_.load(std::memory_order_acquire) &&
+         consumed_.load(std::memory_order_relaxed) == produced_.load(std::memory_order_acquire);
+}
+
+bool DownloadPipeline::fill() {
+  if (!is_active() || eof_.load(std::memory_order_relaxed) || failed_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  bool progress = false;
+  // release() peut vider blocs_ depuis loop() : état et blocs ne sont lus que sous verrou
+  this->lock_();
+  uint32_t produced = produced_.load(std::memory_order_relaxed);
+  if (is_active() && !blocks_.empty() && produced - consumed_.load(std::memory_order_acquire) < blocks_.size()) {
+    // Le bloc est rempli entièrement quand c'est possible : les gros read() sont bien plus
+    // rapides sur FAT/SDMMC que des lectures de la taille d'un segment TCP
+    Block &block = blocks_[produced % blocks_.size()];
+    size_t len = 0;
+    bool eof = false;
+    while (len < block_size_) {
+      ssize_t count = read(fd_, block.data + len, block_size_ - len);
+      if (count < 0) {
+        ESP_LOGE(TAG, "Read failed (errno: %d)", errno);
+        failed_.store(true, std::memory_order_release);
+        break;
+      }
+      if (count == 0) {
+        eof = true;
+        break;
+      }
+      len += count;
+    }
+    if (len > 0 && !has_failed()) {
+      block.len = len;
+      produced_.store(produced + 1, std::memory_order_release);
+    }
+    // Publiée après le dernier bloc pour que is_finished() ne le perde pas
+    if (eof) {
+      eof_.store(true, std::memory_order_release);
+    }
+    progress = true;
+  }
+  this->unlock_();
+  return progress;
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ftp_tasks.h"
+
+namespace esphome {
+namespace ftp_server {
+
+// Pipeline de lecture d'un RETR : une tâche de lecture remplit les blocs depuis la carte SD
+// pendant que loop() envoie le bloc précédent sur la connexion de données.
+// Un seul producteur (la tâche de lecture) et un seul consommateur (loop()) : les compteurs
+// produced_/consumed_ suffisent à se partager l'anneau de blocs sans verrou.
+class DownloadPipeline {
+ public:
+  ~DownloadPipeline();
+
+  // Alloue count blocs de size octets (PSRAM si disponible) ; sans effet s'ils existent déjà
+  bool allocate(size_t count, size_t size);
+  void release();
+  bool is_allocated() const { return !blocks_.empty(); }
+  // Au moins un bloc a dû être pris en mémoire interne faute de PSRAM
+  bool uses_internal_ram() const { return internal_ram_; }
+
+  // Côté loop() : démarre/arrête la lecture de fd. stop() attend la fin d'une lecture en cours,
+  // le descripteur peut ensuite être fermé sans risque.
+  void start(int fd);
+  void stop();
+  bool is_active() const { return active_.load(std::memory_order_acquire); }
+
+  // Côté loop() : données prêtes à envoyer, puis acquittement des octets envoyés.
+  // consume() retourne vrai quand un bloc est libéré et peut être rempli à nouveau.
+  bool peek(const char *&data, size_t &len) const;
+  bool consume(size_t len);
+  bool is_finished() const;
+  bool has_failed() const { return failed_.load(std::memory_order_acquire); }
+
+  // Côté tâche de lecture : remplit au plus un bloc, retourne vrai si du travail a été fait
+  bool fill();
+
+ protected:
+  struct Block {
+    char *data{nullptr};
+    size_t len{0};
+  };
+
+  void lock_();
+  void unlock_();
+  void release_();
+
+  std::vector<Block> blocks_;
+  size_t block_size_{0};
+  bool internal_ram_{false};
+  int fd_{-1};
+  size_t head_pos_{0};  // octets déjà envoyés du bloc en tête
+  std::atomic<bool> active_{false};
+  std::atomic<bool> eof_{false};
+  std::atomic<bool> failed_{false};
+  std::atomic<uint32_t> produced_{0};
+  std::atomic<uint32_t> consumed_{0};
+  FTPMutex mutex_;
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
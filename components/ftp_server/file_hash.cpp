@@ -0,0 +1,145 @@
+#include "file_hash.h"
+#include <cstring>
+
+namespace esphome {
+namespace ftp_server {
+
+uint32_t Crc32::TABLES[8][256];
+
+void Crc32::init_tables() {
+  if (TABLES[0][1] != 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    TABLES[0][i] = crc;
+  }
+  // TABLES[k][i] : CRC de l'octet i suivi de k octets nuls
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++) {
+      TABLES[k][i] = (TABLES[k - 1][i] >> 8) ^ TABLES[0][TABLES[k - 1][i] & 0xFF];
+    }
+  }
+}
+
+uint32_t Crc32::update(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+
+  // Octets de tête jusqu'à un alignement sur 4 pour les lectures 32 bits
+  while (len > 0 && (reinterpret_cast<uintptr_t>(bytes) & 3) != 0) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *bytes++) & 0xFF];
+    len--;
+  }
+  // 8 octets par itération (ESP32 et hôtes de test sont little-endian)
+  while (len >= 8) {
+    uint32_t low;
+    uint32_t high;
+    memcpy(&low, bytes, 4);
+    memcpy(&high, bytes + 4, 4);
+    low ^= crc;
+    crc = TABLES[7][low & 0xFF] ^ TABLES[6][(low >> 8) & 0xFF] ^ TABLES[5][(low >> 16) & 0xFF] ^
+          TABLES[4][low >> 24] ^ TABLES[3][high & 0xFF] ^ TABLES[2][(high >> 8) & 0xFF] ^
+          TABLES[1][(high >> 16) & 0xFF] ^ TABLES[0][high >> 24];
+    bytes += 8;
+    len -= 8;
+  }
+  while (len-- > 0) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *bytes++) & 0xFF];
+  }
+  return ~crc;
+}
+
+void FileHash::begin(HashAlgorithm algorithm) {
+  this->reset();
+  algorithm_ = algorithm;
+  active_ = true;
+  switch (algorithm) {
+    case HASH_CRC32:
+      crc_ = 0;
+      break;
+    case HASH_MD5:
+      mbedtls_md5_init(&md5_);
+      mbedtls_md5_starts(&md5_);
+      break;
+    case HASH_SHA256:
+      mbedtls_sha256_init(&sha256_);
+      mbedtls_sha256_starts(&sha256_, 0);
+      break;
+  }
+}
+
+void FileHash::update(const void *data, size_t len) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  switch (algorithm_) {
+    case HASH_CRC32:
+      crc_ = Crc32::update(crc_, bytes, len);
+      break;
+    case HASH_MD5:
+      mbedtls_md5_update(&md5_, bytes, len);
+      break;
+    case HASH_SHA256:
+      mbedtls_sha256_update(&sha256_, bytes, len);
+      break;
+  }
+}
+
+std::string FileHash::finish() {
+  unsigned char digest[32];
+  size_t length = 0;
+  switch (algorithm_) {
+    case HASH_CRC32:
+      digest[0] = crc_ >> 24;
+      digest[1] = crc_ >> 16;
+      digest[2] = crc_ >> 8;
+      digest[3] = crc_;
+      length = 4;
+      break;
+    case HASH_MD5:
+      mbedtls_md5_finish(&md5_, digest);
+      length = 16;
+      break;
+    case HASH_SHA256:
+      mbedtls_sha256_finish(&sha256_, digest);
+      length = 32;
+      break;
+  }
+  this->reset();
+
+  static const char HEX[] = "0123456789abcdef";
+  std::string hex(length * 2, '0');
+  for (size_t i = 0; i < length; i++) {
+    hex[i * 2] = HEX[digest[i] >> 4];
+    hex[i * 2 + 1] = HEX[digest[i] & 0x0F];
+  }
+  return hex;
+}
+
+void FileHash::reset() {
+  if (!active_) {
+    return;
+  }
+  if (algorithm_ == HASH_MD5) {
+    mbedtls_md5_free(&md5_);
+  } else if (algorithm_ == HASH_SHA256) {
+    mbedtls_sha256_free(&sha256_);
+  }
+  active_ = false;
+}
+
+const char *FileHash::algorithm_name(HashAlgorithm algorithm) {
+  switch (algorithm) {
+    case HASH_CRC32:
+      return "CRC32";
+    case HASH_MD5:
+      return "MD5";
+    default:
+      return "SHA-256";
+  }
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
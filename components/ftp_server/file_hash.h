@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
+
+namespace esphome {
+namespace ftp_server {
+
+enum HashAlgorithm : uint8_t {
+  HASH_CRC32,
+  HASH_MD5,
+  HASH_SHA256,
+};
+
+// CRC-32 (polynôme zlib) par tranches de 8 octets : 8 tables de 256 entrées, soit 8 Ko
+class Crc32 {
+ public:
+  // À appeler une fois depuis la tâche principale avant tout calcul
+  static void init_tables();
+  static uint32_t update(uint32_t crc, const void *data, size_t len);
+
+ protected:
+  static uint32_t TABLES[8][256];
+};
+
+// Empreinte incrémentale d'un fichier, quel que soit l'algorithme choisi
+class FileHash {
+ public:
+  ~FileHash() { this->reset(); }
+
+  void begin(HashAlgorithm algorithm);
+  void update(const void *data, size_t len);
+  // Empreinte en hexadécimal minuscule, libère le contexte
+  std::string finish();
+  void reset();
+  HashAlgorithm get_algorithm() const { return algorithm_; }
+
+  static const char *algorithm_name(HashAlgorithm algorithm);
+
+ protected:
+  HashAlgorithm algorithm_{HASH_CRC32};
+  bool active_{false};
+  uint32_t crc_{0};
+  mbedtls_md5_context md5_;
+  mbedtls_sha256_context sha256_;
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+namespace esphome {
+namespace ftp_server {
+
+// Compteurs alimentés par loop() et par les tâches de transfert. Uniquement des atomiques
+// 32 bits (sans verrou sur Xtensa, contrairement aux 64 bits) remis à zéro à chaque
+// publication : les totaux 64 bits sont cumulés côté publication, sur la tâche principale.
+class FTPMetrics {
+ public:
+  // Histogramme log2 des temps jusqu'au premier octet : le bucket i couvre [2^(i-1), 2^i) ms
+  static const int TTFB_BUCKETS = 16;
+
+  struct Snapshot {
+    uint32_t sent{0};
+    uint32_t received{0};
+    uint32_t data_connection_failures{0};
+    uint32_t ttfb[TTFB_BUCKETS]{};
+    uint32_t ttfb_count{0};
+  };
+
+  void add_sent(uint32_t bytes) { sent_.fetch_add(bytes, std::memory_order_relaxed); }
+  void add_received(uint32_t bytes) { received_.fetch_add(bytes, std::memory_order_relaxed); }
+  void add_data_connection_failure() { data_connection_failures_.fetch_add(1, std::memory_order_relaxed); }
+
+  void record_ttfb(uint32_t ms) {
+    int bucket = ms == 0 ? 0 : 32 - __builtin_clz(ms);
+    if (bucket >= TTFB_BUCKETS) {
+      bucket = TTFB_BUCKETS - 1;
+    }
+    ttfb_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Relève les compteurs depuis la relève précédente
+  void collect(Snapshot &snapshot) {
+    snapshot.sent = sent_.exchange(0, std::memory_order_relaxed);
+    snapshot.received = received_.exchange(0, std::memory_order_relaxed);
+    snapshot.data_connection_failures = data_connection_failures_.exchange(0, std::memory_order_relaxed);
+    snapshot.ttfb_count = 0;
+    for (int i = 0; i < TTFB_BUCKETS; i++) {
+      snapshot.ttfb[i] = ttfb_[i].exchange(0, std::memory_order_relaxed);
+      snapshot.ttfb_count += snapshot.ttfb[i];
+    }
+  }
+
+  // Percentile (0..1) en ms, interpolé linéairement dans le bucket ; NAN sans mesure
+  static float ttfb_percentile(const Snapshot &snapshot, float p) {
+    if (snapshot.ttfb_count == 0) {
+      return NAN;
+    }
+    float rank = p * snapshot.ttfb_count;
+    uint32_t cumulated = 0;
+    for (int i = 0; i < TTFB_BUCKETS; i++) {
+      if (snapshot.ttfb[i] == 0) {
+        continue;
+      }
+      if (cumulated + snapshot.ttfb[i] >= rank) {
+        float low = i == 0 ? 0.0f : static_cast<float>(1u << (i - 1));
+        float high = static_cast<float>(1u << i);
+        return low + (high - low) * (rank - cumulated) / snapshot.ttfb[i];
+      }
+      cumulated += snapshot.ttfb[i];
+    }
+    return static_cast<float>(1u << (TTFB_BUCKETS - 1));
+  }
+
+ protected:
+  std::atomic<uint32_t> sent_{0};
+  std::atomic<uint32_t> received_{0};
+  std::atomic<uint32_t> data_connection_failures_{0};
+  std::atomic<uint32_t> ttfb_[TTFB_BUCKETS]{};
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,30 @@
+#pragma once
+
+// Les quelques appels ESP-IDF utilisés par ftp_server. Sur la plateforme host d'ESPHome
+// (Linux/POSIX), ils sont remplacés par leurs équivalents de la libc pour pouvoir faire
+// tourner et mesurer le serveur sur un PC, contre un répertoire local.
+
+#ifdef USE_HOST
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include "esphome/core/log.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+inline void *heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline void heap_caps_free(void *buffer) { free(buffer); }
+
+#else
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_netif.h"
+
+#endif
@@ -1,60 +1,53 @@
 #include "ftp_server.h"
-#include "../sd_mmc_card/sd_mmc_card.h"
-#include "esp_log.h"
+#include "ftp_platform.h"
+#include "esphome/core/hal.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <chrono>
+#include <sys/select.h>
 #include <ctime>
-#include "esp_netif.h"
-#include "esp_err.h"
 #include <errno.h>
+#ifdef USE_HOST
+#include <ifaddrs.h>
+#include <net/if.h>
+#endif
 
 namespace esphome {
 namespace ftp_server {
 
 static const char *TAG = "ftp_server";
 
-FTPServer::FTPServer() : 
-  ftp_server_socket_(-1),
-  passive_data_socket_(-1),
-  passive_data_port_(-1),
-  passive_mode_enabled_(false),
-  rename_from_("") {}
-
-std::string normalize_path(const std::string& base_path, const std::string& path) {
-  std::string result;
-  
-  if (path.empty() || path == ".") {
-    return base_path;
-  }
-  
-  if (path[0] == '/') {
-    if (path == "/sdcard") {
-      return base_path;
-    }
-    std::string clean_path = path;
-    if (base_path.back() == '/' && path[0] == '/') {
-      clean_path = path.substr(1);
-    }
-    result = base_path + clean_path;
-  } else {
-    if (base_path.back() == '/') {
-      result = base_path + path;
-    } else {
-      result = base_path + "/" + path;
-    }
+// Traces binaires : sans USE_FTP_SERVER_TRACE, les appels disparaissent à la compilation
+#ifdef USE_FTP_SERVER_TRACE
+#define FTP_TRACE(type, session, ...) trace_.record(type, session_id(session), micros(), ##__VA_ARGS__)
+#else
+#define FTP_TRACE(type, session, ...)
+#endif
+
+FTPServer::FTPServer() : ftp_server_socket_(-1) {
+  // Les indices sont empilés à l'envers pour que la session 0 soit attribuée en premier
+  for (size_t i = 0; i < FTP_MAX_SESSIONS; i++) {
+    free_slots_[i] = FTP_MAX_SESSIONS - 1 - i;
   }
-  
-  ESP_LOGD(TAG, "Normalized path: %s (from base: %s, request: %s)", 
-           result.c_str(), base_path.c_str(), path.c_str());
-  
-  return result;
+  free_slot_count_ = FTP_MAX_SESSIONS;
+  listing_cache_.set_capacity(FTP_LISTING_CACHE_DEFAULT_SIZE);
+}
+
+#ifdef USE_FTP_SERVER_SD_MMC
+void FTPServer::set_sd_mmc_card(sd_mmc_card::SdMmc *card) {
+  // Les écritures faites hors FTP (actions, autres composants) rendent aussi les listings obsolètes
+  card->add_on_file_changed_callback([this](const std::string &path) { this->listing_cache_.invalidate(path); });
 }
+#endif
 
 void FTPServer::setup() {
   ESP_LOGI(TAG, "Setting up FTP server...");
+  Crc32::init_tables();
 
   if (root_path_.empty()) {
     root_path_ = "/";
@@ -63,6 +56,13 @@ void FTPServer::setup() {
   if (root_path_.back() != '/') {
     root_path_ += '/';
   }
+  path_resolver_.set_root(root_path_);
+#ifdef USE_FTP_SERVER_TRACE
+  if (!trace_.allocate(trace_events_)) {
+    ESP_LOGW(TAG, "Failed to allocate trace buffer (%u events)", (unsigned) trace_events_);
+  }
+#endif
+  resolved_path_.reserve(PathResolver::MAX_PATH);
 
   DIR *dir = opendir(root_path_.c_str());
   if (dir == nullptr) {
@@ -119,15 +119,179 @@ void FTPServer::setup() {
 
   fcntl(ftp_server_socket_, F_SETFL, O_NONBLOCK);
 
+  // Cœur -1 : pas d'affinité, le planificateur choisit le cœur
+  if (download_buffer_count_ > 0 &&
+      !reader_task_.start(FTPServer::reader_task, this, "ftp_reader", 4096, transfer_worker_priority_,
+                          transfer_worker_core_)) {
+    ESP_LOGW(TAG, "Failed to start reader task, downloads will be read from loop()");
+  }
+
+  if (transfer_worker_count_ > 0) {
+    size_t started = 0;
+    bool queued = transfer_queue_.create(FTP_MAX_SESSIONS);
+    for (size_t i = 0; queued && i < transfer_worker_count_ && i < FTP_MAX_TRANSFER_WORKERS; i++) {
+      char name[16];
+      snprintf(name, sizeof(name), "ftp_worker%u", (unsigned) i);
+      if (transfer_tasks_[i].start(FTPServer::transfer_worker, this, name, 4096, transfer_worker_priority_,
+                                   transfer_worker_core_)) {
+        started++;
+      }
+    }
+    // Sans aucune tâche, les transferts mis en file ne seraient jamais exécutés
+    if (started == 0) {
+      ESP_LOGW(TAG, "Failed to start transfer workers, transfers will run in loop()");
+      transfer_queue_.destroy();
+    }
+  }
+
+#ifdef USE_ESP_IDF
+  // Toute acquisition ou perte d'adresse (Wi-Fi, Ethernet) rend l'adresse annoncée obsolète
+  if (esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, FTPServer::ip_event_handler, this) != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to register IP event handler, PASV address will not be cached");
+  }
+#endif
+
+  if (passive_port_first_ > 0) {
+    size_t listening = passive_ports_.open(passive_port_first_, passive_port_last_);
+    ESP_LOGI(TAG, "Passive ports %u-%u: %u listening", passive_ports_.first_port(), passive_ports_.last_port(),
+             (unsigned) listening);
+  }
+
+  if (metrics_interval_ > 0) {
+    metrics_published_at_ = millis();
+    this->set_interval("metrics", metrics_interval_, [this]() { this->publish_metrics(); });
+  }
+
   ESP_LOGI(TAG, "FTP server started on port %d", port_);
   ESP_LOGI(TAG, "Root directory: %s", root_path_.c_str());
-  current_path_ = root_path_;
+}
+
+static bool would_block() { return errno == EWOULDBLOCK || errno == EAGAIN; }
+
+// Transfert limité en débit dont l'attente n'est pas écoulée
+static bool is_throttled(const FTPTransfer &transfer, uint32_t now) {
+  return transfer.throttle_ms > 0 && static_cast<int32_t>(now - transfer.resume_at) < 0;
+}
+
+// Tampons volumineux : PSRAM en priorité, mémoire interne sinon (internal l'indique)
+static char *allocate_buffer(size_t size, bool *internal = nullptr) {
+  void *buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  bool in_internal_ram = buffer == nullptr;
+  if (in_internal_ram) {
+    buffer = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+  if (internal != nullptr) {
+    *internal = in_internal_ram;
+  }
+  return static_cast<char *>(buffer);
 }
 
 void FTPServer::loop() {
-  handle_new_clients();
-  for (size_t i = 0; i < client_sockets_.size(); i++) {
-    handle_ftp_client(client_sockets_[i]);
+  if (ftp_server_socket_ < 0) {
+    return;
+  }
+
+  // Un seul select() non bloquant multiplexe l'écoute, les connexions de contrôle
+  // et les connexions de données de tous les clients.
+  fd_set read_fds;
+  fd_set write_fds;
+  FD_ZERO(&read_fds);
+  FD_ZERO(&write_fds);
+  int max_fd = ftp_server_socket_;
+  FD_SET(ftp_server_socket_, &read_fds);
+  uint32_t now = millis();
+
+  for (const auto &session : sessions_) {
+    if (!session.in_use()) {
+      continue;
+    }
+    const FTPTransfer &transfer = session.transfer;
+    FTPTransferState state = transfer.state.load(std::memory_order_acquire);
+    int fd = session.control_socket;
+    fd_set *set = &read_fds;
+    if (state == FTP_TRANSFER_WAIT_CONNECTION) {
+      // Passif : attente d'un accept() ; actif : attente de la fin du connect()
+      if (session.data_mode == FTP_DATA_ACTIVE) {
+        fd = transfer.data_socket;
+        set = &write_fds;
+      } else {
+        fd = session.passive_socket;
+      }
+    } else if (state == FTP_TRANSFER_DONE || transfer.offloaded) {
+      continue;
+    } else if (state == FTP_TRANSFER_ACTIVE) {
+      // Un socket presque toujours prêt ferait tourner loop() à vide pendant l'attente
+      if (is_throttled(transfer, now)) {
+        continue;
+      }
+      fd = transfer.data_socket;
+      if (!is_upload(transfer.kind)) {
+        set = &write_fds;
+      }
+    }
+    // Les commandes suivantes restent dans le tampon TCP tant qu'un transfert est en cours
+    if (fd < 0) {
+      continue;
+    }
+    FD_SET(fd, set);
+    max_fd = std::max(max_fd, fd);
+  }
+
+  struct timeval tv = {0, 0};
+  int ready = select(max_fd + 1, &read_fds, &write_fds, nullptr, &tv);
+  if (ready < 0) {
+    if (errno != EINTR) {
+      ESP_LOGW(TAG, "select() failed (errno: %d)", errno);
+    }
+    return;
+  }
+
+  for (auto &session : sessions_) {
+    if (!session.in_use()) {
+      continue;
+    }
+    FTPTransfer &transfer = session.transfer;
+    switch (transfer.state.load(std::memory_order_acquire)) {
+      case FTP_TRANSFER_IDLE:
+        if (FD_ISSET(session.control_socket, &read_fds)) {
+          handle_ftp_client(session);
+        } else {
+          // Commandes mises en file pendant le transfert qui vient de se terminer
+          run_pending_commands(session);
+        }
+        break;
+      case FTP_TRANSFER_WAIT_CONNECTION:
+        if ((session.passive_socket >= 0 && FD_ISSET(session.passive_socket, &read_fds)) ||
+            (transfer.data_socket >= 0 && FD_ISSET(transfer.data_socket, &write_fds))) {
+          step_transfer(session);
+        } else if (now - transfer.started_at > FTP_DATA_CONNECTION_TIMEOUT_MS) {
+          finish_transfer(session, 425, "Can't open data connection");
+        }
+        break;
+      case FTP_TRANSFER_ACTIVE:
+        // Un calcul d'empreinte n'a pas de socket de données : il avance à chaque loop()
+        if (!transfer.offloaded &&
+            (transfer.kind == FTP_TRANSFER_HASH || FD_ISSET(transfer.data_socket, &read_fds) ||
+             FD_ISSET(transfer.data_socket, &write_fds))) {
+          step_transfer(session);
+        }
+        break;
+      case FTP_TRANSFER_DONE:
+        // Transfert terminé par une tâche de travail
+        finish_transfer(session, transfer.result_code, transfer.result_message);
+        break;
+    }
+  }
+
+  if (FD_ISSET(ftp_server_socket_, &read_fds)) {
+    handle_new_clients();
+  }
+
+  // Tant qu'un transfert est actif, loop() est appelée sans la pause habituelle
+  if (has_active_transfers()) {
+    high_freq_.start();
+  } else {
+    high_freq_.stop();
   }
 }
 
@@ -136,6 +300,22 @@ void FTPServer::dump_config() {
   ESP_LOGI(TAG, "  Port: %d", port_);
   ESP_LOGI(TAG, "  Root Path: %s", root_path_.c_str());
   ESP_LOGI(TAG, "  Username: %s", username_.c_str());
+  ESP_LOGI(TAG, "  Listing cache: %u bytes", (unsigned) listing_cache_.get_capacity());
+  ESP_LOGI(TAG, "  Download buffers: %u x %u bytes", (unsigned) download_buffer_count_,
+           (unsigned) download_buffer_size_);
+  ESP_LOGI(TAG, "  Transfer workers: %u (core %d, priority %d)", (unsigned) transfer_worker_count_,
+           transfer_worker_core_, transfer_worker_priority_);
+  ESP_LOGI(TAG, "  MODE Z: %u bytes budget, level %d", (unsigned) compression_memory_, compression_level_);
+  ESP_LOGI(TAG, "  Bandwidth (B/s, 0 = unlimited): download %u, upload %u, per session %u/%u%s",
+           (unsigned) shaper_.get_global_rate(FTP_DIRECTION_DOWNLOAD),
+           (unsigned) shaper_.get_global_rate(FTP_DIRECTION_UPLOAD),
+           (unsigned) shaper_.get_session_rate(FTP_DIRECTION_DOWNLOAD),
+           (unsigned) shaper_.get_session_rate(FTP_DIRECTION_UPLOAD), shaper_.get_fair_share() ? ", fair share" : "");
+  if (passive_ports_.is_enabled()) {
+    ESP_LOGI(TAG, "  Passive ports: %u-%u (pre-listening)", passive_ports_.first_port(), passive_ports_.last_port());
+  } else {
+    ESP_LOGI(TAG, "  Passive ports: ephemeral");
+  }
   ESP_LOGI(TAG, "  Server status: %s", is_running() ? "Running" : "Not running");
 }
 
@@ -144,625 +324,1951 @@ void FTPServer::handle_new_clients() {
   socklen_t client_len = sizeof(client_addr);
   int client_socket = accept(ftp_server_socket_, (struct sockaddr *)&client_addr, &client_len);
   if (client_socket >= 0) {
+    if (free_slot_count_ == 0) {
+      ESP_LOGW(TAG, "Rejecting FTP client: all %u sessions in use", (unsigned) FTP_MAX_SESSIONS);
+      send_response(client_socket, 421, "Too many users, try again later");
+      close(client_socket);
+      return;
+    }
     fcntl(client_socket, F_SETFL, O_NONBLOCK);
     char client_ip[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
     ESP_LOGI(TAG, "New FTP client connected from %s:%d", client_ip, ntohs(client_addr.sin_port));
-    client_sockets_.push_back(client_socket);
-    client_states_.push_back(FTP_WAIT_LOGIN);
-    client_usernames_.push_back("");
-    client_current_paths_.push_back(root_path_);
+
+    FTPSession &session = sessions_[free_slots_[--free_slot_count_]];
+    session.control_socket = client_socket;
+    session.state = FTP_WAIT_LOGIN;
+    session.username.clear();
+    session.current_path = root_path_;
+    session.rename_from.clear();
+    session.restart_offset = 0;
+    session.allocation_hint = 0;
+    session.epsv_all = false;
+    FTP_TRACE(FTP_TRACE_CONNECT, session);
     send_response(client_socket, 220, "Welcome to ESPHome FTP Server");
   }
 }
 
-void FTPServer::handle_ftp_client(int client_socket) {
+void FTPServer::handle_ftp_client(FTPSession &session) {
   char buffer[512];
-  int len = recv(client_socket, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+  int len = recv(session.control_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
   if (len > 0) {
-    buffer[len] = '\0';
-    std::string command(buffer);
-    process_command(client_socket, command);
-  } else if (len == 0) {
-    ESP_LOGI(TAG, "FTP client disconnected");
-    close(client_socket);
-    auto it = std::find(client_sockets_.begin(), client_sockets_.end(), client_socket);
-    if (it != client_sockets_.end()) {
-      size_t index = it - client_sockets_.begin();
-      client_sockets_.erase(it);
-      client_states_.erase(client_states_.begin() + index);
-      client_usernames_.erase(client_usernames_.begin() + index);
-      client_current_paths_.erase(client_current_paths_.begin() + index);
-    }
-  } else if (errno != EWOULDBLOCK && errno != EAGAIN) {
-    ESP_LOGW(TAG, "Socket error: %d", errno);
-  }
-}
-
-void FTPServer::process_command(int client_socket, const std::string& command) {
-  ESP_LOGI(TAG, "FTP command: %s", command.c_str());
-  std::string cmd_str = command;
-  size_t pos = cmd_str.find_first_of("\r\n");
-  if (pos != std::string::npos) {
-    cmd_str = cmd_str.substr(0, pos);
-  }
-
-  auto it = std::find(client_sockets_.begin(), client_sockets_.end(), client_socket);
-  if (it == client_sockets_.end()) {
-    ESP_LOGE(TAG, "Client socket not found!");
-    return;
-  }
-
-  size_t client_index = it - client_sockets_.begin();
-
-  if (cmd_str.find("USER") == 0) {
-    std::string username = cmd_str.substr(5);
-    client_usernames_[client_index] = username;
-    send_response(client_socket, 331, "Password required for " + username);
-  } else if (cmd_str.find("PASS") == 0) {
-    std::string password = cmd_str.substr(5);
-    if (authenticate(client_usernames_[client_index], password)) {
-      client_states_[client_index] = FTP_LOGGED_IN;
-      send_response(client_socket, 230, "Login successful");
-    } else {
-      send_response(client_socket, 530, "Login incorrect");
-    }
-  } else if (client_states_[client_index] != FTP_LOGGED_IN) {
-    send_response(client_socket, 530, "Not logged in");
-  } else if (cmd_str.find("SYST") == 0) {
-    send_response(client_socket, 215, "UNIX Type: L8");
-  } else if (cmd_str.find("FEAT") == 0) {
-    send_response(client_socket, 211, "Features:");
-    send_response(client_socket, 211, " SIZE");
-    send_response(client_socket, 211, " MDTM");
-    send_response(client_socket, 211, "End");
-  } else if (cmd_str.find("TYPE") == 0) {
-    send_response(client_socket, 200, "Type set to " + cmd_str.substr(5));
-  } else if (cmd_str.find("PWD") == 0) {
-    std::string current_path = client_current_paths_[client_index];
-    std::string relative_path = "/";
-    if (current_path.length() > root_path_.length()) {
-      relative_path = current_path.substr(root_path_.length() - 1);
-    }
-    send_response(client_socket, 257, "\"" + relative_path + "\" is current directory");
-  } else if (cmd_str.find("CWD") == 0) {
-    std::string path = cmd_str.substr(4);
-    size_t first_non_space = path.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      path = path.substr(first_non_space);
-    }
-    
-    if (path.empty()) {
-      send_response(client_socket, 550, "Failed to change directory - path is empty");
-    } else {
-      std::string current_path = client_current_paths_[client_index];
-      std::string full_path;
-      
-      if (path == "/") {
-        full_path = root_path_;
-      } else {
-        full_path = normalize_path(current_path, path);
-      }
-      
-      ESP_LOGI(TAG, "Attempting to change directory to: %s", full_path.c_str());
-      
-      DIR *dir = opendir(full_path.c_str());
-      if (dir != nullptr) {
-        closedir(dir);
-        client_current_paths_[client_index] = full_path;
-        send_response(client_socket, 250, "Directory successfully changed");
-      } else {
-        ESP_LOGE(TAG, "Failed to open directory: %s (errno: %d)", full_path.c_str(), errno);
-        send_response(client_socket, 550, "Failed to change directory");
-      }
-    }
-  } else if (cmd_str.find("CDUP") == 0) {
-    std::string current = client_current_paths_[client_index];
-    
-    if (current == root_path_ || current.length() <= root_path_.length()) {
-      send_response(client_socket, 250, "Already at root directory");
-      return;
-    }
-    
-    size_t pos = current.find_last_of('/');
-    if (pos != std::string::npos && current.length() > 1) {
-      if (pos == current.length() - 1) {
-        std::string temp = current.substr(0, pos);
-        pos = temp.find_last_of('/');
-      }
-      
-      if (pos != std::string::npos) {
-        std::string parent_dir = current.substr(0, pos + 1);
-        
-        if (parent_dir.length() >= root_path_.length()) {
-          client_current_paths_[client_index] = parent_dir;
-          send_response(client_socket, 250, "Directory successfully changed");
-        } else {
-          client_current_paths_[client_index] = root_path_;
-          send_response(client_socket, 250, "Directory changed to root");
-        }
-      } else {
-        send_response(client_socket, 550, "Failed to change directory");
-      }
-    } else {
-      send_response(client_socket, 550, "Failed to change directory");
-    }
-  } else if (cmd_str.find("PASV") == 0) {
-    if (start_passive_mode(client_socket)) {
-      passive_mode_enabled_ = true;
-    } else {
-      send_response(client_socket, 425, "Can't open passive connection");
-    }
-  } else if (cmd_str.find("LIST") == 0 || cmd_str.find("NLST") == 0) {
-    std::string path_arg = "";
-    std::string cmd_type = cmd_str.substr(0, 4);
-    
-    if (cmd_str.length() > 5) {
-      path_arg = cmd_str.substr(5);
-      size_t first_non_space = path_arg.find_first_not_of(" \t");
-      if (first_non_space != std::string::npos) {
-        path_arg = path_arg.substr(first_non_space);
-      }
-    }
-    
-    std::string list_path;
-    if (path_arg.empty() || path_arg == ".") {
-      list_path = client_current_paths_[client_index];
-    } else {
-      list_path = normalize_path(client_current_paths_[client_index], path_arg);
-    }
-    
-    ESP_LOGI(TAG, "Listing directory: %s", list_path.c_str());
-    send_response(client_socket, 150, "Opening ASCII mode data connection for file list");
-    
-    if (cmd_type == "LIST") {
-      list_directory(client_socket, list_path);
-    } else {
-      list_names(client_socket, list_path);
-    }
-  } else if (cmd_str.find("STOR") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
-    }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], filename);
-    ESP_LOGI(TAG, "Starting file upload to: %s", full_path.c_str());
-    send_response(client_socket, 150, "Opening connection for file upload");
-    start_file_upload(client_socket, full_path);
-  } else if (cmd_str.find("RETR") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
-    }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], filename);
-    ESP_LOGI(TAG, "Starting file download from: %s", full_path.c_str());
-    
-    struct stat file_stat;
-    if (stat(full_path.c_str(), &file_stat) == 0) {
-      if (S_ISREG(file_stat.st_mode)) {
-        std::string size_msg = "Opening connection for file download (" +
-                              std::to_string(file_stat.st_size) + " bytes)";
-        send_response(client_socket, 150, size_msg);
-        start_file_download(client_socket, full_path);
-      } else {
-        send_response(client_socket, 550, "Not a regular file");
-      }
-    } else {
-      ESP_LOGE(TAG, "File not found: %s (errno: %d)", full_path.c_str(), errno);
-      send_response(client_socket, 550, "File not found");
-    }
-  } else if (cmd_str.find("DELE") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
-    }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], filename);
-    ESP_LOGI(TAG, "Deleting file: %s", full_path.c_str());
-    
-    if (unlink(full_path.c_str()) == 0) {
-      send_response(client_socket, 250, "File deleted successfully");
+    assemble_command_lines(session, buffer, len);
+    run_pending_commands(session);
+  } else if (len == 0 || !would_block()) {
+    if (len == 0) {
+      ESP_LOGI(TAG, "FTP client disconnected");
     } else {
-      ESP_LOGE(TAG, "Failed to delete file: %s (errno: %d)", full_path.c_str(), errno);
-      send_response(client_socket, 550, "Failed to delete file");
-    }
-  } else if (cmd_str.find("MKD") == 0) {
-    std::string dirname = cmd_str.substr(4);
-    size_t first_non_space = dirname.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      dirname = dirname.substr(first_non_space);
-    }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], dirname);
-    ESP_LOGI(TAG, "Creating directory: %s", full_path.c_str());
-    
-    if (mkdir(full_path.c_str(), 0755) == 0) {
-      send_response(client_socket, 257, "Directory created");
-    } else {
-      ESP_LOGE(TAG, "Failed to create directory: %s (errno: %d)", full_path.c_str(), errno);
-      send_response(client_socket, 550, "Failed to create directory");
-    }
-  } else if (cmd_str.find("RMD") == 0) {
-    std::string dirname = cmd_str.substr(4);
-    size_t first_non_space = dirname.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      dirname = dirname.substr(first_non_space);
-    }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], dirname);
-    ESP_LOGI(TAG, "Removing directory: %s", full_path.c_str());
-    
-    if (rmdir(full_path.c_str()) == 0) {
-      send_response(client_socket, 250, "Directory removed");
-    } else {
-      ESP_LOGE(TAG, "Failed to remove directory: %s (errno: %d)", full_path.c_str(), errno);
-      send_response(client_socket, 550, "Failed to remove directory");
-    }
-  } else if (cmd_str.find("RNFR") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
-    }
-    
-    rename_from_ = normalize_path(client_current_paths_[client_index], filename);
-    struct stat file_stat;
-    if (stat(rename_from_.c_str(), &file_stat) == 0) {
-      send_response(client_socket, 350, "Ready for RNTO");
-    } else {
-      ESP_LOGE(TAG, "File not found for rename: %s (errno: %d)", rename_from_.c_str(), errno);
-      send_response(client_socket, 550, "File not found");
-      rename_from_ = "";
+      ESP_LOGW(TAG, "Socket error: %d", errno);
     }
-  } else if (cmd_str.find("RNTO") == 0) {
-    if (rename_from_.empty()) {
-      send_response(client_socket, 503, "RNFR required first");
-    } else {
-      std::string filename = cmd_str.substr(5);
-      size_t first_non_space = filename.find_first_not_of(" \t");
-      if (first_non_space != std::string::npos) {
-        filename = filename.substr(first_non_space);
-      }
-      
-      std::string rename_to = normalize_path(client_current_paths_[client_index], filename);
-      ESP_LOGI(TAG, "Renaming from %s to %s", rename_from_.c_str(), rename_to.c_str());
-      
-      if (rename(rename_from_.c_str(), rename_to.c_str()) == 0) {
-        send_response(client_socket, 250, "Rename successful");
-      } else {
-        ESP_LOGE(TAG, "Failed to rename: %s -> %s (errno: %d)", 
-                 rename_from_.c_str(), rename_to.c_str(), errno);
-        send_response(client_socket, 550, "Rename failed");
-      }
-      rename_from_ = "";
+    close_session(session);
+  }
+}
+
+// Tampons de transfert gardés par la session. En PSRAM, ils servent jusqu'à sa fermeture ;
+// pris en mémoire interne faute de PSRAM, ils sont rendus après chaque transfert
+// (internal_only) pour que des sessions inactives n'immobilisent pas le tas interne.
+void FTPServer::release_session_buffers(FTPSession &session, bool internal_only) {
+  if (session.listing_buffer != nullptr && (!internal_only || session.listing_buffer_internal)) {
+    heap_caps_free(session.listing_buffer);
+    session.listing_buffer = nullptr;
+  }
+  // UploadSink::finish() a déjà tout écrit
+  if (session.upload_buffer != nullptr && (!internal_only || session.upload_buffer_internal)) {
+    heap_caps_free(session.upload_buffer);
+    session.upload_buffer = nullptr;
+  }
+  // Lecture déjà arrêtée par stop() : la tâche de lecture ne touche plus aux blocs
+  if (!internal_only || session.download.uses_internal_ram()) {
+    session.download.release();
+  }
+}
+
+void FTPServer::assemble_command_lines(FTPSession &session, const char *data, size_t len) {
+  const char *end = data + len;
+  while (data < end) {
+    const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+    const char *chunk_end = newline != nullptr ? newline : end;
+    size_t chunk_len = chunk_end - data;
+
+    // Une ligne trop longue est ignorée jusqu'à son terminateur puis refusée
+    if (session.line_length + chunk_len > sizeof(session.line_buffer)) {
+      session.line_overflow = true;
+    } else if (!session.line_overflow) {
+      memcpy(session.line_buffer + session.line_length, data, chunk_len);
+      session.line_length += chunk_len;
     }
-  } else if (cmd_str.find("SIZE") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
+
+    if (newline == nullptr) {
+      break;
     }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], filename);
-    struct stat file_stat;
-    if (stat(full_path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
-      send_response(client_socket, 213, std::to_string(file_stat.st_size));
-    } else {
-      send_response(client_socket, 550, "File not found or not a regular file");
+
+    size_t line_length = session.line_length;
+    if (line_length > 0 && session.line_buffer[line_length - 1] == '\r') {
+      line_length--;
     }
-  } else if (cmd_str.find("MDTM") == 0) {
-    std::string filename = cmd_str.substr(5);
-    size_t first_non_space = filename.find_first_not_of(" \t");
-    if (first_non_space != std::string::npos) {
-      filename = filename.substr(first_non_space);
+    if (session.line_overflow) {
+      session.pending_commands.emplace_back();
+    } else if (line_length > 0) {
+      session.pending_commands.emplace_back(session.line_buffer, line_length);
     }
-    
-    std::string full_path = normalize_path(client_current_paths_[client_index], filename);
-    struct stat file_stat;
-    if (stat(full_path.c_str(), &file_stat) == 0) {
-      char mdtm_str[15];
-      struct tm *tm_info = gmtime(&file_stat.st_mtime);
-      strftime(mdtm_str, sizeof(mdtm_str), "%Y%m%d%H%M%S", tm_info);
-      send_response(client_socket, 213, mdtm_str);
-    } else {
-      send_response(client_socket, 550, "File not found");
-    }
-  } else if (cmd_str.find("NOOP") == 0) {
-    send_response(client_socket, 200, "NOOP command successful");
-  } else if (cmd_str.find("QUIT") == 0) {
-    send_response(client_socket, 221, "Goodbye");
-    close(client_socket);
-    auto it = std::find(client_sockets_.begin(), client_sockets_.end(), client_socket);
-    if (it != client_sockets_.end()) {
-      size_t index = it - client_sockets_.begin();
-      client_sockets_.erase(it);
-      client_states_.erase(client_states_.begin() + index);
-      client_usernames_.erase(client_usernames_.begin() + index);
-      client_current_paths_.erase(client_current_paths_.begin() + index);
+    session.line_length = 0;
+    session.line_overflow = false;
+    data = newline + 1;
+  }
+}
+
+void FTPServer::run_pending_commands(FTPSession &session) {
+  // Un transfert démarré par une commande suspend l'exécution des suivantes jusqu'à sa fin
+  while (session.in_use() && session.transfer.state == FTP_TRANSFER_IDLE && !session.pending_commands.empty()) {
+    std::string command = std::move(session.pending_commands.front());
+    session.pending_commands.pop_front();
+    if (command.empty()) {
+      send_response(session.control_socket, 500, "Command line too long");
+      continue;
     }
-  } else {
-    send_response(client_socket, 502, "Command not implemented");
+    process_command(session, command);
   }
 }
 
-void FTPServer::send_response(int client_socket, int code, const std::string& message) {
-  std::string response = std::to_string(code) + " " + message + "\r\n";
-  send(client_socket, response.c_str(), response.length(), 0);
-  ESP_LOGD(TAG, "Sent: %s", response.c_str());
+void FTPServer::close_session(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  FTP_TRACE(FTP_TRACE_DISCONNECT, session);
+  session.download.stop();
+  if (is_upload(transfer.kind) && transfer.file_fd >= 0) {
+    session.upload.finish();
+  }
+  if (transfer.file_fd >= 0) {
+    close(transfer.file_fd);
+    transfer.file_fd = -1;
+  }
+  if (transfer.dir != nullptr) {
+    closedir(transfer.dir);
+    transfer.dir = nullptr;
+  }
+  if (transfer.data_socket >= 0) {
+    close(transfer.data_socket);
+    transfer.data_socket = -1;
+  }
+  if (is_upload(transfer.kind)) {
+    listing_cache_.invalidate(transfer.path);
+  }
+  if (transfer.shaped) {
+    shaper_.end_transfer(direction_of(transfer.kind));
+    transfer.shaped = false;
+  }
+  transfer.kind = FTP_TRANSFER_NONE;
+  transfer.state = FTP_TRANSFER_IDLE;
+  close_data_connection(session);
+  transfer.cached.reset();
+  transfer.capture = std::string();
+  transfer.capturing = false;
+  compression_in_use_ -= session.zstream.end();
+  session.mode_z = false;
+  transfer.hash.reset();
+
+  release_session_buffers(session, false);
+  close(session.control_socket);
+  session.control_socket = -1;
+  session.line_length = 0;
+  session.line_overflow = false;
+  session.pending_commands.clear();
+  free_slots_[free_slot_count_++] = &session - sessions_;
 }
 
-bool FTPServer::authenticate(const std::string& username, const std::string& password) {
-  return username == username_ && password == password_;
+// Faits RFC 3659 d'une entrée, tous issus d'un même stat() : type, taille, date, permissions
+static size_t format_mlsx_facts(const struct stat &entry_stat, char *out, size_t out_size) {
+  // Versions réentrantes : plusieurs tâches de travail peuvent produire des listings à la fois
+  char modify[15];
+  struct tm modified;
+  strftime(modify, sizeof(modify), "%Y%m%d%H%M%S", gmtime_r(&entry_stat.st_mtime, &modified));
+  bool is_dir = S_ISDIR(entry_stat.st_mode);
+  int len = snprintf(out, out_size, "type=%s;size=%lld;modify=%s;perm=%s;", is_dir ? "dir" : "file",
+                     (long long) entry_stat.st_size, modify, is_dir ? "flcdmpe" : "rwadf");
+  return len > 0 ? std::min<size_t>(len, out_size - 1) : 0;
 }
 
-bool FTPServer::start_passive_mode(int client_socket) {
-  if (passive_data_socket_ != -1) {
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
+// Met en forme une entrée de LIST/NLST/MLSD dans out. Retourne 0 si l'entrée doit être ignorée.
+static size_t format_directory_entry(FTPTransferKind kind, const std::string &dir_path, const char *name,
+                                     char *out, size_t out_size) {
+  int len;
+  if (kind == FTP_TRANSFER_NLST) {
+    // NLST ne publie que les noms : aucun stat() nécessaire
+    len = snprintf(out, out_size, "%s\r\n", name);
+    return len > 0 ? std::min<size_t>(len, out_size - 1) : 0;
   }
 
-  passive_data_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (passive_data_socket_ < 0) {
-    ESP_LOGE(TAG, "Failed to create passive data socket (errno: %d)", errno);
-    return false;
+  char full_path[512];
+  bool has_separator = !dir_path.empty() && dir_path.back() == '/';
+  snprintf(full_path, sizeof(full_path), "%s%s%s", dir_path.c_str(), has_separator ? "" : "/", name);
+  struct stat entry_stat;
+  if (stat(full_path, &entry_stat) != 0) {
+    return 0;
   }
 
-  int opt = 1;
-  if (setsockopt(passive_data_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    ESP_LOGE(TAG, "Failed to set socket options for passive mode (errno: %d)", errno);
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
+  if (kind == FTP_TRANSFER_MLSD) {
+    size_t facts = format_mlsx_facts(entry_stat, out, out_size);
+    len = snprintf(out + facts, out_size - facts, " %s\r\n", name);
+    return len > 0 ? std::min<size_t>(facts + len, out_size - 1) : 0;
   }
 
-  struct sockaddr_in data_addr;
-  memset(&data_addr, 0, sizeof(data_addr));
-  data_addr.sin_family = AF_INET;
-  data_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  data_addr.sin_port = htons(0);
-
-  if (bind(passive_data_socket_, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0) {
-    ESP_LOGE(TAG, "Failed to bind passive data socket (errno: %d)", errno);
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
-  }
+  char time_str[80];
+  struct tm modified;
+  strftime(time_str, sizeof(time_str), "%b %d %H:%M", localtime_r(&entry_stat.st_mtime, &modified));
+
+  char perm_str[11] = "----------";
+  if (S_ISDIR(entry_stat.st_mode)) perm_str[0] = 'd';
+  if (entry_stat.st_mode & S_IRUSR) perm_str[1] = 'r';
+  if (entry_stat.st_mode & S_IWUSR) perm_str[2] = 'w';
+  if (entry_stat.st_mode & S_IXUSR) perm_str[3] = 'x';
+  if (entry_stat.st_mode & S_IRGRP) perm_str[4] = 'r';
+  if (entry_stat.st_mode & S_IWGRP) perm_str[5] = 'w';
+  if (entry_stat.st_mode & S_IXGRP) perm_str[6] = 'x';
+  if (entry_stat.st_mode & S_IROTH) perm_str[7] = 'r';
+  if (entry_stat.st_mode & S_IWOTH) perm_str[8] = 'w';
+  if (entry_stat.st_mode & S_IXOTH) perm_str[9] = 'x';
+
+  len = snprintf(out, out_size, "%s 1 root root %8ld %s %s\r\n",
+                 perm_str, (long) entry_stat.st_size, time_str, name);
+  return len > 0 ? std::min<size_t>(len, out_size - 1) : 0;
+}
 
-  if (listen(passive_data_socket_, 1) < 0) {
-    ESP_LOGE(TAG, "Failed to listen on passive data socket (errno: %d)", errno);
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
-  }
+// Encode un verbe FTP (jusqu'à 8 caractères) en entier aligné à gauche :
+// l'ordre numérique des codes est alors l'ordre alphabétique des verbes.
+static constexpr uint64_t ftp_verb(const char *verb, int shift = 56) {
+  return *verb == '\0' ? 0 : (uint64_t(uint8_t(*verb)) << shift) | ftp_verb(verb + 1, shift - 8);
+}
 
-  struct sockaddr_in sin;
-  socklen_t len = sizeof(sin);
-  if (getsockname(passive_data_socket_, (struct sockaddr *)&sin, &len) < 0) {
-    ESP_LOGE(TAG, "Failed to get socket name (errno: %d)", errno);
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
-  }
+// Table triée par ordre alphabétique, consultée par recherche dichotomique sur le code entier
+const FTPCommand FTPServer::COMMANDS[] = {
+    {ftp_verb("ALLO"), &FTPServer::cmd_allo, true, FTP_ARG_TEXT},
+    {ftp_verb("APPE"), &FTPServer::cmd_appe, true, FTP_ARG_PATH},
+    {ftp_verb("CDUP"), &FTPServer::cmd_cdup, true, FTP_ARG_NONE},
+    {ftp_verb("CWD"), &FTPServer::cmd_cwd, true, FTP_ARG_PATH},
+    {ftp_verb("DELE"), &FTPServer::cmd_dele, true, FTP_ARG_PATH},
+    {ftp_verb("EPRT"), &FTPServer::cmd_eprt, true, FTP_ARG_TEXT},
+    {ftp_verb("EPSV"), &FTPServer::cmd_epsv, true, FTP_ARG_OPTIONAL},
+    {ftp_verb("FEAT"), &FTPServer::cmd_feat, false, FTP_ARG_NONE},
+    {ftp_verb("HASH"), &FTPServer::cmd_hash, true, FTP_ARG_PATH},
+    {ftp_verb("LIST"), &FTPServer::cmd_list, true, FTP_ARG_LIST},
+    {ftp_verb("MDTM"), &FTPServer::cmd_mdtm, true, FTP_ARG_PATH},
+    {ftp_verb("MKD"), &FTPServer::cmd_mkd, true, FTP_ARG_PATH},
+    {ftp_verb("MLSD"), &FTPServer::cmd_mlsd, true, FTP_ARG_LIST},
+    {ftp_verb("MLST"), &FTPServer::cmd_mlst, true, FTP_ARG_LIST},
+    {ftp_verb("MODE"), &FTPServer::cmd_mode, true, FTP_ARG_TEXT},
+    {ftp_verb("NLST"), &FTPServer::cmd_nlst, true, FTP_ARG_LIST},
+    {ftp_verb("NOOP"), &FTPServer::cmd_noop, false, FTP_ARG_NONE},
+    {ftp_verb("PASS"), &FTPServer::cmd_pass, false, FTP_ARG_OPTIONAL},
+    {ftp_verb("PASV"), &FTPServer::cmd_pasv, true, FTP_ARG_NONE},
+    {ftp_verb("PORT"), &FTPServer::cmd_port, true, FTP_ARG_TEXT},
+    {ftp_verb("PWD"), &FTPServer::cmd_pwd, true, FTP_ARG_NONE},
+    {ftp_verb("QUIT"), &FTPServer::cmd_quit, false, FTP_ARG_NONE},
+    {ftp_verb("REST"), &FTPServer::cmd_rest, true, FTP_ARG_TEXT},
+    {ftp_verb("RETR"), &FTPServer::cmd_retr, true, FTP_ARG_PATH},
+    {ftp_verb("RMD"), &FTPServer::cmd_rmd, true, FTP_ARG_PATH},
+    {ftp_verb("RNFR"), &FTPServer::cmd_rnfr, true, FTP_ARG_PATH},
+    {ftp_verb("RNTO"), &FTPServer::cmd_rnto, true, FTP_ARG_PATH},
+    {ftp_verb("SIZE"), &FTPServer::cmd_size, true, FTP_ARG_PATH},
+    {ftp_verb("STOR"), &FTPServer::cmd_stor, true, FTP_ARG_PATH},
+    {ftp_verb("SYST"), &FTPServer::cmd_syst, true, FTP_ARG_NONE},
+    {ftp_verb("TYPE"), &FTPServer::cmd_type, true, FTP_ARG_TEXT},
+    {ftp_verb("USER"), &FTPServer::cmd_user, false, FTP_ARG_TEXT},
+    {ftp_verb("XCRC"), &FTPServer::cmd_xcrc, true, FTP_ARG_PATH},
+    {ftp_verb("XCUP"), &FTPServer::cmd_cdup, true, FTP_ARG_NONE},
+    {ftp_verb("XCWD"), &FTPServer::cmd_cwd, true, FTP_ARG_PATH},
+    {ftp_verb("XMD5"), &FTPServer::cmd_xmd5, true, FTP_ARG_PATH},
+    {ftp_verb("XMKD"), &FTPServer::cmd_mkd, true, FTP_ARG_PATH},
+    {ftp_verb("XPWD"), &FTPServer::cmd_pwd, true, FTP_ARG_NONE},
+    {ftp_verb("XRMD"), &FTPServer::cmd_rmd, true, FTP_ARG_PATH},
+    {ftp_verb("XSHA256"), &FTPServer::cmd_xsha256, true, FTP_ARG_PATH},
+};
+
+static const FTPCommand *find_command(const FTPCommand *begin, const FTPCommand *end, uint64_t verb) {
+  const FTPCommand *it =
+      std::lower_bound(begin, end, verb, [](const FTPCommand &command, uint64_t v) { return command.verb < v; });
+  return (it != end && it->verb == verb) ? it : nullptr;
+}
 
-  passive_data_port_ = ntohs(sin.sin_port);
+void FTPServer::process_command(FTPSession &session, const std::string& command) {
+  // Jamais le mot de passe dans les journaux
+  ESP_LOGV(TAG, "FTP command: %s", strncasecmp(command.c_str(), "PASS", 4) == 0 ? "PASS ****" : command.c_str());
 
-  esp_netif_t *netif = esp_netif_get_default_netif();
-  if (netif == nullptr) {
-    ESP_LOGE(TAG, "Failed to get default netif");
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
+  // Une seule passe : verbe mis en majuscules et encodé, puis argument sans espaces de tête
+  uint64_t verb = 0;
+  size_t pos = 0;
+  while (pos < command.length() && command[pos] != ' ' && pos < 8) {
+    verb |= uint64_t(toupper(static_cast<unsigned char>(command[pos]))) << (56 - 8 * pos);
+    pos++;
   }
-  esp_netif_ip_info_t ip_info;
-  if (esp_netif_get_ip_info(netif, &ip_info) != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to get IP info");
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    return false;
+  FTP_TRACE(FTP_TRACE_COMMAND, session, verb);
+  const FTPCommand *entry = nullptr;
+  if (pos == command.length() || command[pos] == ' ') {
+    entry = find_command(std::begin(COMMANDS), std::end(COMMANDS), verb);
+  }
+  if (entry == nullptr) {
+    send_response(session.control_socket, 502, "Command not implemented");
+    return;
+  }
+  if (entry->login_required && session.state != FTP_LOGGED_IN) {
+    send_response(session.control_socket, 530, "Not logged in");
+    return;
   }
 
-  uint32_t ip = ip_info.ip.addr;
-  std::string response = "Entering Passive Mode (" +
-                        std::to_string((ip & 0xFF)) + "," +
-                        std::to_string((ip >> 8) & 0xFF) + "," +
-                        std::to_string((ip >> 16) & 0xFF) + "," +
-                        std::to_string((ip >> 24) & 0xFF) + "," +
-                        std::to_string(passive_data_port_ >> 8) + "," +
-                        std::to_string(passive_data_port_ & 0xFF) + ")";
+  pos = command.find_first_not_of(" \t", pos);
+  std::string argument = pos != std::string::npos ? command.substr(pos) : std::string();
+  // Les chemins sont résolus dans resolved_path_, dont la capacité est réservée au démarrage
+  const std::string *resolved = &argument;
+
+  switch (entry->argument) {
+    case FTP_ARG_NONE:
+      argument.clear();
+      break;
+    case FTP_ARG_OPTIONAL:
+      break;
+    case FTP_ARG_TEXT:
+    case FTP_ARG_PATH:
+      if (argument.empty()) {
+        send_response(session.control_socket, 501, "Syntax error in parameters or arguments");
+        return;
+      }
+      if (entry->argument == FTP_ARG_PATH) {
+        if (!resolve_path(session, argument)) {
+          return;
+        }
+        resolved = &resolved_path_;
+      }
+      break;
+    case FTP_ARG_LIST:
+      // Les options de type "ls" (LIST -la) ne désignent pas un chemin
+      while (!argument.empty() && argument[0] == '-') {
+        size_t next = argument.find_first_of(" \t");
+        next = next != std::string::npos ? argument.find_first_not_of(" \t", next) : std::string::npos;
+        argument = next != std::string::npos ? argument.substr(next) : std::string();
+      }
+      if (!resolve_path(session, argument)) {
+        return;
+      }
+      resolved = &resolved_path_;
+      break;
+  }
 
-  send_response(client_socket, 227, response);
-  return true;
+  (this->*entry->handler)(session, *resolved);
 }
 
-int FTPServer::open_data_connection(int client_socket) {
-  if (passive_data_socket_ == -1) {
-    return -1;
+bool FTPServer::resolve_path(FTPSession &session, const std::string &request) {
+  std::string_view path;
+  if (!path_resolver_.resolve(session.current_path, request, path)) {
+    send_response(session.control_socket, 553, "File name not allowed");
+    return false;
   }
+  resolved_path_.assign(path.data(), path.size());
+  return true;
+}
 
-  struct timeval tv;
-  tv.tv_sec = 5;
-  tv.tv_usec = 0;
-
-  fd_set readfds;
-  FD_ZERO(&readfds);
-  FD_SET(passive_data_socket_, &readfds);
+void FTPServer::cmd_user(FTPSession &session, const std::string &username) {
+  session.username = username;
+  session.state = FTP_WAIT_LOGIN;
+  send_response(session.control_socket, 331, "Password required for " + username);
+}
 
-  int ret = select(passive_data_socket_ + 1, &readfds, nullptr, nullptr, &tv);
-  if (ret <= 0) {
-    return -1;
+void FTPServer::cmd_pass(FTPSession &session, const std::string &password) {
+  if (authenticate(session.username, password)) {
+    session.state = FTP_LOGGED_IN;
+    send_response(session.control_socket, 230, "Login successful");
+  } else {
+    send_response(session.control_socket, 530, "Login incorrect");
   }
+}
 
-  struct sockaddr_in client_addr;
-  socklen_t client_len = sizeof(client_addr);
-  int data_socket = accept(passive_data_socket_, (struct sockaddr *)&client_addr, &client_len);
+void FTPServer::cmd_syst(FTPSession &session, const std::string &) {
+  send_response(session.control_socket, 215, "UNIX Type: L8");
+}
 
-  if (data_socket < 0) {
-    return -1;
+void FTPServer::cmd_feat(FTPSession &session, const std::string &) {
+  // Réponse multi-lignes (RFC 2389) : "211-" en tête, une fonctionnalité par ligne indentée
+  std::string features =
+      "211-Features:\r\n"
+      " EPRT\r\n"
+      " EPSV\r\n"
+      " SIZE\r\n"
+      " MDTM\r\n"
+      " MLST type*;size*;modify*;perm*;\r\n"
+      " REST STREAM\r\n"
+      " HASH SHA-256*\r\n";
+  if (compression_memory_ > 0) {
+    features += " MODE Z\r\n";
   }
+  features += "211 End\r\n";
+  send(session.control_socket, features.c_str(), features.length(), 0);
+}
 
-  int flags = fcntl(data_socket, F_GETFL, 0);
-  fcntl(data_socket, F_SETFL, flags & ~O_NONBLOCK);
+void FTPServer::cmd_type(FTPSession &session, const std::string &type) {
+  send_response(session.control_socket, 200, "Type set to " + type);
+}
 
-  return data_socket;
+void FTPServer::cmd_pwd(FTPSession &session, const std::string &) {
+  send_response(session.control_socket, 257, "\"" + client_path(session.current_path) + "\" is current directory");
+}
+
+void FTPServer::cmd_cwd(FTPSession &session, const std::string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (dir != nullptr) {
+    closedir(dir);
+    session.current_path = path;
+    send_response(session.control_socket, 250, "Directory successfully changed");
+  } else {
+    ESP_LOGW(TAG, "Failed to open directory: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "Failed to change directory");
+  }
 }
 
-void FTPServer::close_data_connection(int client_socket) {
-  if (passive_data_socket_ != -1) {
-    close(passive_data_socket_);
-    passive_data_socket_ = -1;
-    passive_data_port_ = -1;
-    passive_mode_enabled_ = false;
+void FTPServer::cmd_cdup(FTPSession &session, const std::string &) {
+  // ".." s'arrête à la racine : CDUP depuis "/" y reste
+  if (resolve_path(session, "..")) {
+    session.current_path = resolved_path_;
+    send_response(session.control_socket, 250, "Directory successfully changed");
   }
 }
 
-void FTPServer::list_directory(int client_socket, const std::string& path) {
-  int data_socket = open_data_connection(client_socket);
-  if (data_socket < 0) {
-    send_response(client_socket, 425, "Can't open data connection");
+void FTPServer::cmd_pasv(FTPSession &session, const std::string &) {
+  if (session.epsv_all) {
+    send_response(session.control_socket, 501, "PASV not allowed after EPSV ALL");
     return;
   }
-
-  DIR *dir = opendir(path.c_str());
-  if (dir == nullptr) {
-    close(data_socket);
-    close_data_connection(client_socket);
-    send_response(client_socket, 550, "Failed to open directory");
+  uint32_t ip;
+  if (!get_advertised_ip(ip) || !open_passive_listener(session)) {
+    close_data_connection(session);
+    metrics_.add_data_connection_failure();
+    send_response(session.control_socket, 425, "Can't open passive connection");
     return;
   }
 
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != nullptr) {
-    std::string entry_name = entry->d_name;
-    if (entry_name == "." || entry_name == "..") {
-      continue;
-    }
+  std::string response = "Entering Passive Mode (" +
+                        std::to_string((ip & 0xFF)) + "," +
+                        std::to_string((ip >> 8) & 0xFF) + "," +
+                        std::to_string((ip >> 16) & 0xFF) + "," +
+                        std::to_string((ip >> 24) & 0xFF) + "," +
+                        std::to_string(session.passive_port >> 8) + "," +
+                        std::to_string(session.passive_port & 0xFF) + ")";
+  send_response(session.control_socket, 227, response);
+}
 
-    std::string full_path = path + "/" + entry_name;
-    struct stat entry_stat;
-    if (stat(full_path.c_str(), &entry_stat) == 0) {
-      char time_str[80];
-      strftime(time_str, sizeof(time_str), "%b %d %H:%M", localtime(&entry_stat.st_mtime));
-      
-      char perm_str[11] = "----------";
-      if (S_ISDIR(entry_stat.st_mode)) perm_str[0] = 'd';
-      if (entry_stat.st_mode & S_IRUSR) perm_str[1] = 'r';
-      if (entry_stat.st_mode & S_IWUSR) perm_str[2] = 'w';
-      if (entry_stat.st_mode & S_IXUSR) perm_str[3] = 'x';
-      if (entry_stat.st_mode & S_IRGRP) perm_str[4] = 'r';
-      if (entry_stat.st_mode & S_IWGRP) perm_str[5] = 'w';
-      if (entry_stat.st_mode & S_IXGRP) perm_str[6] = 'x';
-      if (entry_stat.st_mode & S_IROTH) perm_str[7] = 'r';
-      if (entry_stat.st_mode & S_IWOTH) perm_str[8] = 'w';
-      if (entry_stat.st_mode & S_IXOTH) perm_str[9] = 'x';
-
-      char list_item[512];
-      snprintf(list_item, sizeof(list_item),
-               "%s 1 root root %8ld %s %s\r\n",
-               perm_str, (long)entry_stat.st_size, time_str, entry_name.c_str());
-      
-      send(data_socket, list_item, strlen(list_item), 0);
-    }
-  }
-
-  closedir(dir);
-  close(data_socket);
-  close_data_connection(client_socket);
-  send_response(client_socket, 226, "Directory send OK");
-}
-
-void FTPServer::list_names(int client_socket, const std::string& path) {
-  int data_socket = open_data_connection(client_socket);
-  if (data_socket < 0) {
-    send_response(client_socket, 425, "Can't open data connection");
+void FTPServer::cmd_epsv(FTPSession &session, const std::string &argument) {
+  // RFC 2428 : seul le port est annoncé, le client réutilise l'adresse de la connexion de contrôle
+  if (strcasecmp(argument.c_str(), "ALL") == 0) {
+    session.epsv_all = true;
+    send_response(session.control_socket, 200, "EPSV ALL command successful");
     return;
   }
-
-  DIR *dir = opendir(path.c_str());
-  if (dir == nullptr) {
-    close(data_socket);
-    close_data_connection(client_socket);
-    send_response(client_socket, 550, "Failed to open directory");
+  if (!argument.empty() && argument != "1") {
+    send_response(session.control_socket, 522, "Network protocol not supported, use (1)");
     return;
   }
+  if (!open_passive_listener(session)) {
+    close_data_connection(session);
+    metrics_.add_data_connection_failure();
+    send_response(session.control_socket, 425, "Can't open passive connection");
+    return;
+  }
+  send_response(session.control_socket, 229,
+                "Entering Extended Passive Mode (|||" + std::to_string(session.passive_port) + "|)");
+}
 
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != nullptr) {
-    std::string entry_name = entry->d_name;
-    if (entry_name == "." || entry_name == "..") {
-      continue;
-    }
-
-    std::string full_path = path + "/" + entry_name;
-    struct stat entry_stat;
-    if (stat(full_path.c_str(), &entry_stat) == 0) {
-      std::string list_item = entry_name + "\r\n";
-      send(data_socket, list_item.c_str(), list_item.length(), 0);
-    }
+bool FTPServer::set_active_address(FTPSession &session, uint32_t ip, uint16_t port) {
+  // Protection contre le "FTP bounce" : l'adresse doit être celle du client de contrôle
+  struct sockaddr_in peer;
+  socklen_t len = sizeof(peer);
+  if (getpeername(session.control_socket, (struct sockaddr *)&peer, &len) < 0 ||
+      peer.sin_addr.s_addr != ip || port == 0) {
+    send_response(session.control_socket, 501, "Illegal PORT command");
+    return false;
   }
 
-  closedir(dir);
-  close(data_socket);
-  close_data_connection(client_socket);
-  send_response(client_socket, 226, "Directory send OK");
+  close_data_connection(session);
+  memset(&session.active_address, 0, sizeof(session.active_address));
+  session.active_address.sin_family = AF_INET;
+  session.active_address.sin_addr.s_addr = ip;
+  session.active_address.sin_port = htons(port);
+  session.data_mode = FTP_DATA_ACTIVE;
+  return true;
 }
 
-void FTPServer::start_file_upload(int client_socket, const std::string& path) {
-  int data_socket = open_data_connection(client_socket);
-  if (data_socket < 0) {
-    send_response(client_socket, 425, "Can't open data connection");
+void FTPServer::cmd_port(FTPSession &session, const std::string &argument) {
+  if (session.epsv_all) {
+    send_response(session.control_socket, 501, "PORT not allowed after EPSV ALL");
     return;
   }
-
-  int file_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-  if (file_fd < 0) {
-    close(data_socket);
-    close_data_connection(client_socket);
-    send_response(client_socket, 550, "Failed to open file for writing");
+  unsigned int h1, h2, h3, h4, p1, p2;
+  char trailing;
+  if (sscanf(argument.c_str(), "%u,%u,%u,%u,%u,%u%c", &h1, &h2, &h3, &h4, &p1, &p2, &trailing) != 6 ||
+      h1 > 255 || h2 > 255 || h3 > 255 || h4 > 255 || p1 > 255 || p2 > 255) {
+    send_response(session.control_socket, 501, "Syntax error in PORT arguments");
     return;
   }
-
-  char buffer[2048];
-  int len;
-  while ((len = recv(data_socket, buffer, sizeof(buffer), 0)) > 0) {
-    write(file_fd, buffer, len);
+  uint32_t ip = htonl((h1 << 24) | (h2 << 16) | (h3 << 8) | h4);
+  if (set_active_address(session, ip, (p1 << 8) | p2)) {
+    send_response(session.control_socket, 200, "PORT command successful");
   }
-
-  close(file_fd);
-  close(data_socket);
-  close_data_connection(client_socket);
-  send_response(client_socket, 226, "Transfer complete");
 }
 
-void FTPServer::start_file_download(int client_socket, const std::string& path) {
-  int data_socket = open_data_connection(client_socket);
-  if (data_socket < 0) {
-    send_response(client_socket, 425, "Can't open data connection");
+void FTPServer::cmd_eprt(FTPSession &session, const std::string &argument) {
+  if (session.epsv_all) {
+    send_response(session.control_socket, 501, "EPRT not allowed after EPSV ALL");
+    return;
+  }
+  // Format : <d>proto<d>adresse<d>port<d>, le délimiteur étant le premier caractère
+  char delimiter = argument[0];
+  size_t first = argument.find(delimiter, 1);
+  size_t second = first != std::string::npos ? argument.find(delimiter, first + 1) : std::string::npos;
+  size_t third = second != std::string::npos ? argument.find(delimiter, second + 1) : std::string::npos;
+  if (third == std::string::npos) {
+    send_response(session.control_socket, 501, "Syntax error in EPRT arguments");
     return;
   }
 
-  int file_fd = open(path.c_str(), O_RDONLY);
-  if (file_fd < 0) {
-    close(data_socket);
-    close_data_connection(client_socket);
-    send_response(client_socket, 550, "Failed to open file for reading");
+  std::string protocol = argument.substr(1, first - 1);
+  std::string address = argument.substr(first + 1, second - first - 1);
+  std::string port = argument.substr(second + 1, third - second - 1);
+  if (protocol != "1") {
+    send_response(session.control_socket, 522, "Network protocol not supported, use (1)");
     return;
   }
 
-  char buffer[2048];
-  int len;
-  while ((len = read(file_fd, buffer, sizeof(buffer))) > 0) {
-    send(data_socket, buffer, len, 0);
+  struct in_addr ip;
+  char *end = nullptr;
+  unsigned long port_number = strtoul(port.c_str(), &end, 10);
+  if (inet_pton(AF_INET, address.c_str(), &ip) != 1 || end == port.c_str() || *end != '\0' || port_number > 65535) {
+    send_response(session.control_socket, 501, "Syntax error in EPRT arguments");
+    return;
+  }
+  if (set_active_address(session, ip.s_addr, port_number)) {
+    send_response(session.control_socket, 200, "EPRT command successful");
+  }
+}
+
+void FTPServer::cmd_list(FTPSession &session, const std::string &path) {
+  ESP_LOGV(TAG, "Listing directory: %s", path.c_str());
+  start_transfer(session, FTP_TRANSFER_LIST, path, "Opening ASCII mode data connection for file list");
+}
+
+void FTPServer::cmd_nlst(FTPSession &session, const std::string &path) {
+  ESP_LOGV(TAG, "Listing names: %s", path.c_str());
+  start_transfer(session, FTP_TRANSFER_NLST, path, "Opening ASCII mode data connection for file list");
+}
+
+void FTPServer::cmd_mlsd(FTPSession &session, const std::string &path) {
+  struct stat dir_stat;
+  if (stat(path.c_str(), &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+    send_response(session.control_socket, 550, "Not a directory");
+    return;
   }
+  ESP_LOGV(TAG, "Machine listing: %s", path.c_str());
+  start_transfer(session, FTP_TRANSFER_MLSD, path, "Opening ASCII mode data connection for MLSD");
+}
 
-  close(file_fd);
-  close(data_socket);
-  close_data_connection(client_socket);
-  send_response(client_socket, 226, "Transfer complete");
+// Chemin tel que le client le voit, la racine du serveur devenant "/"
+std::string FTPServer::client_path(const std::string &path) const {
+  if (path.length() > root_path_.length()) {
+    return path.substr(root_path_.length() - 1);
+  }
+  return "/";
+}
+
+void FTPServer::cmd_mlst(FTPSession &session, const std::string &path) {
+  struct stat entry_stat;
+  if (stat(path.c_str(), &entry_stat) != 0) {
+    send_response(session.control_socket, 550, "File not found");
+    return;
+  }
+
+  // Réponse sur la connexion de contrôle : le nom affiché est le chemin vu par le client
+  std::string name = client_path(path);
+  char facts[128];
+  format_mlsx_facts(entry_stat, facts, sizeof(facts));
+  std::string response = "250-Listing " + name + "\r\n " + facts + " " + name + "\r\n250 End\r\n";
+  send(session.control_socket, response.c_str(), response.length(), 0);
+}
+
+void FTPServer::cmd_mode(FTPSession &session, const std::string &mode) {
+  if (mode == "S" || mode == "s") {
+    session.mode_z = false;
+    send_response(session.control_socket, 200, "Mode set to S");
+  } else if ((mode == "Z" || mode == "z") && compression_memory_ > 0) {
+    session.mode_z = true;
+    send_response(session.control_socket, 200, "Mode set to Z");
+  } else {
+    send_response(session.control_socket, 504, "Unsupported transfer mode");
+  }
+}
+
+void FTPServer::cmd_hash(FTPSession &session, const std::string &path) {
+  start_hash(session, path, HASH_SHA256, true);
+}
+
+void FTPServer::cmd_xcrc(FTPSession &session, const std::string &path) {
+  start_hash(session, path, HASH_CRC32, false);
+}
+
+void FTPServer::cmd_xmd5(FTPSession &session, const std::string &path) {
+  start_hash(session, path, HASH_MD5, false);
+}
+
+void FTPServer::cmd_xsha256(FTPSession &session, const std::string &path) {
+  start_hash(session, path, HASH_SHA256, false);
+}
+
+void FTPServer::start_hash(FTPSession &session, const std::string &path, HashAlgorithm algorithm,
+                           bool hash_command) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    send_response(session.control_socket, 550, "File not found");
+    return;
+  }
+
+  std::string digest;
+  if (digest_cache_.find(path, algorithm, file_stat.st_size, file_stat.st_mtime, digest)) {
+    send_hash_reply(session, hash_command, algorithm, path, file_stat.st_size, digest);
+    return;
+  }
+
+  FTPTransfer &transfer = session.transfer;
+  transfer.file_fd = open(path.c_str(), O_RDONLY);
+  if (transfer.file_fd < 0) {
+    send_response(session.control_socket, 550, "Failed to open file for reading");
+    return;
+  }
+  ESP_LOGV(TAG, "Computing %s of %s", FileHash::algorithm_name(algorithm), path.c_str());
+
+  // Le calcul suit le chemin d'un transfert (lecture par la tâche de lecture, exécution par une
+  // tâche de travail si elles existent) mais la réponse part sur la connexion de contrôle
+  transfer.kind = FTP_TRANSFER_HASH;
+  transfer.path = path;
+  transfer.data_socket = -1;
+  transfer.dir = nullptr;
+  transfer.offset = 0;
+  transfer.bytes_transferred = 0;
+  transfer.buffer_len = 0;
+  transfer.buffer_pos = 0;
+  transfer.cached.reset();
+  transfer.capturing = false;
+  transfer.hash.begin(algorithm);
+  transfer.hash_command = hash_command;
+  transfer.hash_size = file_stat.st_size;
+  transfer.hash_mtime = file_stat.st_mtime;
+  transfer.finished = false;
+
+  if (has_reader_task() && session.download.allocate(download_buffer_count_, download_buffer_size_)) {
+    session.download.start(transfer.file_fd);
+    wake_reader();
+  }
+  transfer.started_at = millis();
+  transfer.state = FTP_TRANSFER_ACTIVE;
+  FTP_TRACE(FTP_TRACE_TRANSFER_BEGIN, session, 0, FTP_TRANSFER_HASH);
+
+  if (transfer_queue_.is_created()) {
+    transfer.offloaded = true;
+    if (!transfer_queue_.send(&session)) {
+      transfer.offloaded = false;
+    }
+  }
+}
+
+void FTPServer::send_hash_reply(FTPSession &session, bool hash_command, HashAlgorithm algorithm,
+                                const std::string &path, uint64_t size, const std::string &digest) {
+  if (!hash_command) {
+    // XCRC/XMD5/XSHA256 : l'empreinte seule, en majuscules comme les serveurs qui les ont introduites
+    std::string upper = digest;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    send_response(session.control_socket, 250, upper);
+    return;
+  }
+  // HASH (draft-bryan-ftpext-hash) : "213 <algorithme> <début>-<fin> <empreinte> <fichier>"
+  send_response(session.control_socket, 213,
+                std::string(FileHash::algorithm_name(algorithm)) + " 0-" + std::to_string(size) + " " + digest + " " +
+                    client_path(path));
+}
+
+void FTPServer::cmd_stor(FTPSession &session, const std::string &path) {
+  uint64_t offset = session.restart_offset;
+  session.restart_offset = 0;
+
+  if (offset > 0) {
+    // Reprise : le fichier existant doit couvrir au moins l'offset demandé
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode) ||
+        static_cast<uint64_t>(file_stat.st_size) < offset) {
+      send_response(session.control_socket, 554, "Invalid REST parameter");
+      return;
+    }
+    ESP_LOGV(TAG, "Resuming file upload to: %s at offset %llu", path.c_str(), (unsigned long long) offset);
+  } else {
+    ESP_LOGV(TAG, "Starting file upload to: %s", path.c_str());
+  }
+  start_transfer(session, FTP_TRANSFER_STOR, path, "Opening connection for file upload", offset);
+}
+
+void FTPServer::cmd_appe(FTPSession &session, const std::string &path) {
+  session.restart_offset = 0;
+  session.allocation_hint = 0;
+  ESP_LOGV(TAG, "Starting file append to: %s", path.c_str());
+  start_transfer(session, FTP_TRANSFER_APPE, path, "Opening connection for file append");
+}
+
+void FTPServer::cmd_allo(FTPSession &session, const std::string &argument) {
+  // "ALLO <taille> [R <enregistrement>]" : seule la taille sert, pour réserver la place au STOR suivant
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long size = strtoull(argument.c_str(), &end, 10);
+  if (errno != 0 || end == argument.c_str() || argument[0] == '-') {
+    send_response(session.control_socket, 501, "Invalid ALLO size");
+    return;
+  }
+  session.allocation_hint = size;
+  send_response(session.control_socket, 200, "ALLO command successful");
+}
+
+void FTPServer::cmd_rest(FTPSession &session, const std::string &argument) {
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long offset = strtoull(argument.c_str(), &end, 10);
+  if (errno != 0 || end == argument.c_str() || *end != '\0' || argument[0] == '-') {
+    send_response(session.control_socket, 501, "Invalid REST offset");
+    return;
+  }
+  session.restart_offset = offset;
+  send_response(session.control_socket, 350,
+                "Restarting at " + std::to_string(offset) + ". Send STORE or RETRIEVE to initiate transfer");
+}
+
+void FTPServer::cmd_retr(FTPSession &session, const std::string &path) {
+  uint64_t offset = session.restart_offset;
+  session.restart_offset = 0;
+  ESP_LOGV(TAG, "Starting file download from: %s", path.c_str());
+
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    ESP_LOGE(TAG, "File not found: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "File not found");
+  } else if (!S_ISREG(file_stat.st_mode)) {
+    send_response(session.control_socket, 550, "Not a regular file");
+  } else if (offset > static_cast<uint64_t>(file_stat.st_size)) {
+    send_response(session.control_socket, 554, "Invalid REST parameter");
+  } else {
+    start_transfer(session, FTP_TRANSFER_RETR, path,
+                   "Opening connection for file download (" + std::to_string(file_stat.st_size - offset) + " bytes)",
+                   offset);
+  }
+}
+
+void FTPServer::cmd_dele(FTPSession &session, const std::string &path) {
+  ESP_LOGD(TAG, "Deleting file: %s", path.c_str());
+
+  if (unlink(path.c_str()) == 0) {
+    listing_cache_.invalidate(path);
+    digest_cache_.invalidate(path);
+    send_response(session.control_socket, 250, "File deleted successfully");
+  } else {
+    ESP_LOGE(TAG, "Failed to delete file: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "Failed to delete file");
+  }
+}
+
+void FTPServer::cmd_mkd(FTPSession &session, const std::string &path) {
+  ESP_LOGD(TAG, "Creating directory: %s", path.c_str());
+
+  if (mkdir(path.c_str(), 0755) == 0) {
+    listing_cache_.invalidate(path);
+    send_response(session.control_socket, 257, "Directory created");
+  } else {
+    ESP_LOGE(TAG, "Failed to create directory: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "Failed to create directory");
+  }
+}
+
+void FTPServer::cmd_rmd(FTPSession &session, const std::string &path) {
+  ESP_LOGD(TAG, "Removing directory: %s", path.c_str());
+
+  if (rmdir(path.c_str()) == 0) {
+    listing_cache_.invalidate(path);
+    send_response(session.control_socket, 250, "Directory removed");
+  } else {
+    ESP_LOGE(TAG, "Failed to remove directory: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "Failed to remove directory");
+  }
+}
+
+void FTPServer::cmd_rnfr(FTPSession &session, const std::string &path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) == 0) {
+    session.rename_from = path;
+    send_response(session.control_socket, 350, "Ready for RNTO");
+  } else {
+    ESP_LOGE(TAG, "File not found for rename: %s (errno: %d)", path.c_str(), errno);
+    send_response(session.control_socket, 550, "File not found");
+    session.rename_from.clear();
+  }
+}
+
+void FTPServer::cmd_rnto(FTPSession &session, const std::string &path) {
+  if (session.rename_from.empty()) {
+    send_response(session.control_socket, 503, "RNFR required first");
+    return;
+  }
+
+  ESP_LOGD(TAG, "Renaming from %s to %s", session.rename_from.c_str(), path.c_str());
+
+  if (rename(session.rename_from.c_str(), path.c_str()) == 0) {
+    listing_cache_.invalidate(session.rename_from);
+    listing_cache_.invalidate(path);
+    digest_cache_.invalidate(session.rename_from);
+    digest_cache_.invalidate(path);
+    send_response(session.control_socket, 250, "Rename successful");
+  } else {
+    ESP_LOGE(TAG, "Failed to rename: %s -> %s (errno: %d)",
+             session.rename_from.c_str(), path.c_str(), errno);
+    send_response(session.control_socket, 550, "Rename failed");
+  }
+  session.rename_from.clear();
+}
+
+void FTPServer::cmd_size(FTPSession &session, const std::string &path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+    send_response(session.control_socket, 213, std::to_string(file_stat.st_size));
+  } else {
+    send_response(session.control_socket, 550, "File not found or not a regular file");
+  }
+}
+
+void FTPServer::cmd_mdtm(FTPSession &session, const std::string &path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) == 0) {
+    char mdtm_str[15];
+    struct tm *tm_info = gmtime(&file_stat.st_mtime);
+    strftime(mdtm_str, sizeof(mdtm_str), "%Y%m%d%H%M%S", tm_info);
+    send_response(session.control_socket, 213, mdtm_str);
+  } else {
+    send_response(session.control_socket, 550, "File not found");
+  }
+}
+
+void FTPServer::cmd_noop(FTPSession &session, const std::string &) {
+  send_response(session.control_socket, 200, "NOOP command successful");
+}
+
+void FTPServer::cmd_quit(FTPSession &session, const std::string &) {
+  send_response(session.control_socket, 221, "Goodbye");
+  close_session(session);
+}
+
+void FTPServer::send_response(int client_socket, int code, const std::string& message) {
+  std::string response = std::to_string(code) + " " + message + "\r\n";
+  send(client_socket, response.c_str(), response.length(), 0);
+  ESP_LOGV(TAG, "Sent: %s", response.c_str());
+#ifdef USE_FTP_SERVER_TRACE
+  for (FTPSession &session : sessions_) {
+    if (session.control_socket == client_socket) {
+      FTP_TRACE(FTP_TRACE_REPLY, session, 0, code);
+      break;
+    }
+  }
+#endif
+}
+
+bool FTPServer::authenticate(const std::string& username, const std::string& password) {
+  return username == username_ && password == password_;
+}
+
+bool FTPServer::open_passive_listener(FTPSession &session) {
+  close_data_connection(session);
+
+  if (passive_ports_.is_enabled()) {
+    session.passive_socket = passive_ports_.acquire(session.passive_port);
+    if (session.passive_socket < 0) {
+      ESP_LOGW(TAG, "No free passive port in %u-%u", passive_ports_.first_port(), passive_ports_.last_port());
+      return false;
+    }
+    session.data_mode = FTP_DATA_PASSIVE;
+    return true;
+  }
+
+  session.passive_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (session.passive_socket < 0) {
+    ESP_LOGE(TAG, "Failed to create passive data socket (errno: %d)", errno);
+    return false;
+  }
+
+  int opt = 1;
+  if (setsockopt(session.passive_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    ESP_LOGE(TAG, "Failed to set socket options for passive mode (errno: %d)", errno);
+    close(session.passive_socket);
+    session.passive_socket = -1;
+    return false;
+  }
+
+  struct sockaddr_in data_addr;
+  memset(&data_addr, 0, sizeof(data_addr));
+  data_addr.sin_family = AF_INET;
+  data_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  data_addr.sin_port = htons(0);
+
+  if (bind(session.passive_socket, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0) {
+    ESP_LOGE(TAG, "Failed to bind passive data socket (errno: %d)", errno);
+    close(session.passive_socket);
+    session.passive_socket = -1;
+    return false;
+  }
+
+  if (listen(session.passive_socket, 1) < 0) {
+    ESP_LOGE(TAG, "Failed to listen on passive data socket (errno: %d)", errno);
+    close(session.passive_socket);
+    session.passive_socket = -1;
+    return false;
+  }
+
+  struct sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+  if (getsockname(session.passive_socket, (struct sockaddr *)&sin, &len) < 0) {
+    ESP_LOGE(TAG, "Failed to get socket name (errno: %d)", errno);
+    close(session.passive_socket);
+    session.passive_socket = -1;
+    return false;
+  }
+
+  session.passive_port = ntohs(sin.sin_port);
+  session.data_mode = FTP_DATA_PASSIVE;
+  return true;
+}
+
+bool FTPServer::get_advertised_ip(uint32_t &ip) {
+  if (!advertised_ip_stale_.load(std::memory_order_acquire) && advertised_ip_ != 0) {
+    ip = advertised_ip_;
+    return true;
+  }
+  // Effacé avant la lecture : un événement arrivé pendant celle-ci force une nouvelle lecture
+  advertised_ip_stale_.store(false, std::memory_order_release);
+#ifdef USE_HOST
+  // Première interface IPv4 active hors boucle locale, la boucle locale à défaut
+  struct ifaddrs *interfaces;
+  if (getifaddrs(&interfaces) != 0) {
+    ESP_LOGE(TAG, "Failed to list network interfaces (errno: %d)", errno);
+    advertised_ip_ = 0;
+    return false;
+  }
+  ip = htonl(INADDR_LOOPBACK);
+  for (struct ifaddrs *it = interfaces; it != nullptr; it = it->ifa_next) {
+    if (it->ifa_addr != nullptr && it->ifa_addr->sa_family == AF_INET && (it->ifa_flags & IFF_UP) &&
+        !(it->ifa_flags & IFF_LOOPBACK)) {
+      ip = reinterpret_cast<struct sockaddr_in *>(it->ifa_addr)->sin_addr.s_addr;
+      break;
+    }
+  }
+  freeifaddrs(interfaces);
+  advertised_ip_ = ip;
+  return true;
+#else
+  esp_netif_t *netif = esp_netif_get_default_netif();
+  if (netif == nullptr) {
+    ESP_LOGE(TAG, "Failed to get default netif");
+    advertised_ip_ = 0;
+    return false;
+  }
+  esp_netif_ip_info_t ip_info;
+  if (esp_netif_get_ip_info(netif, &ip_info) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to get IP info");
+    advertised_ip_ = 0;
+    return false;
+  }
+  // 0 (pas encore d'adresse) n'est pas mis en cache
+  ip = ip_info.ip.addr;
+  advertised_ip_ = ip;
+  return ip != 0;
+#endif
+}
+
+#ifdef USE_ESP_IDF
+void FTPServer::ip_event_handler(void *arg, esp_event_base_t, int32_t, void *) {
+  // Tâche des événements système : seul le drapeau atomique est touché
+  static_cast<FTPServer *>(arg)->advertised_ip_stale_.store(true, std::memory_order_release);
+}
+#endif
+
+bool FTPServer::open_active_connection(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  transfer.data_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (transfer.data_socket < 0) {
+    ESP_LOGE(TAG, "Failed to create active data socket (errno: %d)", errno);
+    return false;
+  }
+
+  // Connexion non bloquante : loop() attend que le socket devienne inscriptible
+  int flags = fcntl(transfer.data_socket, F_GETFL, 0);
+  fcntl(transfer.data_socket, F_SETFL, flags | O_NONBLOCK);
+  if (connect(transfer.data_socket, (struct sockaddr *)&session.active_address, sizeof(session.active_address)) < 0 &&
+      errno != EINPROGRESS) {
+    ESP_LOGE(TAG, "Failed to connect active data socket (errno: %d)", errno);
+    close(transfer.data_socket);
+    transfer.data_socket = -1;
+    return false;
+  }
+  return true;
+}
+
+int FTPServer::accept_data_connection(FTPSession &session) {
+  if (session.data_mode == FTP_DATA_ACTIVE) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(session.transfer.data_socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+      ESP_LOGW(TAG, "Active data connection failed (error: %d)", error);
+      return -1;
+    }
+    return session.transfer.data_socket;
+  }
+
+  if (session.passive_socket == -1) {
+    return -1;
+  }
+
+  struct sockaddr_in client_addr;
+  socklen_t client_len = sizeof(client_addr);
+  int data_socket = accept(session.passive_socket, (struct sockaddr *)&client_addr, &client_len);
+
+  if (data_socket < 0) {
+    return -1;
+  }
+
+  // Un port du pool reste en écoute entre deux sessions : seul le client de contrôle peut s'y connecter
+  if (passive_ports_.is_enabled()) {
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(session.control_socket, (struct sockaddr *)&peer, &peer_len) < 0 ||
+        peer.sin_addr.s_addr != client_addr.sin_addr.s_addr) {
+      ESP_LOGW(TAG, "Rejected passive data connection from another address");
+      close(data_socket);
+      return -1;
+    }
+  }
+
+  int flags = fcntl(data_socket, F_GETFL, 0);
+  fcntl(data_socket, F_SETFL, flags | O_NONBLOCK);
+
+  return data_socket;
+}
+
+void FTPServer::close_data_connection(FTPSession &session) {
+  if (session.passive_socket != -1) {
+    // Un port du pool est rendu en restant en écoute, un port éphémère est fermé
+    if (!passive_ports_.release(session.passive_socket)) {
+      close(session.passive_socket);
+    }
+    session.passive_socket = -1;
+    session.passive_port = 0;
+  }
+  session.data_mode = FTP_DATA_NONE;
+}
+
+// La réponse 150 (opening) ne part qu'une fois le transfert prêt : un refus (425, 451,
+// 550...) arrive seul, avant que le fichier visé n'ait été ouvert ou tronqué
+void FTPServer::start_transfer(FTPSession &session, FTPTransferKind kind, const std::string& path,
+                               const std::string &opening, uint64_t offset) {
+  FTPTransfer &transfer = session.transfer;
+  int client_socket = session.control_socket;
+
+  // Comptée comme les autres 425 dans les échecs de connexion de données
+  if (session.data_mode == FTP_DATA_NONE) {
+    metrics_.add_data_connection_failure();
+    send_response(client_socket, 425, "Use PORT or PASV first");
+    return;
+  }
+
+  transfer.kind = kind;
+  transfer.path = path;
+  transfer.data_socket = -1;
+  transfer.file_fd = -1;
+  transfer.dir = nullptr;
+  transfer.offset = offset;
+  transfer.bytes_transferred = 0;
+  transfer.buffer_len = 0;
+  transfer.buffer_pos = 0;
+  transfer.cached.reset();
+  transfer.capturing = false;
+  transfer.finished = false;
+
+  // La mémoire des flux zlib est réservée pour la durée du transfert, dans la limite du budget
+  if (session.mode_z) {
+    size_t needed = is_upload(kind) ? ZStream::inflate_memory() : ZStream::deflate_memory();
+    bool started = compression_in_use_ + needed <= compression_memory_ &&
+                   (is_upload(kind) ? session.zstream.begin_inflate() : session.zstream.begin_deflate(compression_level_));
+    if (!started) {
+      ESP_LOGW(TAG, "Not enough memory for a MODE Z transfer (%u bytes in use)", (unsigned) compression_in_use_);
+      abort_transfer_setup(session, 451, "Insufficient memory for MODE Z");
+      return;
+    }
+    compression_in_use_ += needed;
+  }
+
+  if (kind == FTP_TRANSFER_LIST || kind == FTP_TRANSFER_NLST || kind == FTP_TRANSFER_MLSD) {
+    transfer.cached = listing_cache_.find(kind, path);
+    if (transfer.cached != nullptr) {
+      ESP_LOGV(TAG, "Listing of %s served from cache", path.c_str());
+      transfer.buffer_len = transfer.cached->size();
+    }
+  }
+
+  if (transfer.cached != nullptr) {
+    // Rien à ouvrir sur la carte
+  } else if (kind == FTP_TRANSFER_LIST || kind == FTP_TRANSFER_NLST || kind == FTP_TRANSFER_MLSD) {
+    if (session.listing_buffer == nullptr) {
+      session.listing_buffer = allocate_buffer(FTP_LISTING_BUFFER_SIZE, &session.listing_buffer_internal);
+      if (session.listing_buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate listing buffer");
+        abort_transfer_setup(session, 451, "Local error in processing");
+        return;
+      }
+    }
+    transfer.dir = opendir(path.c_str());
+    if (transfer.dir == nullptr) {
+      abort_transfer_setup(session, 550, "Failed to open directory");
+      return;
+    }
+    transfer.capturing = listing_cache_.is_enabled();
+    transfer.capture.clear();
+    transfer.cache_generation = listing_cache_.get_generation();
+  } else if (kind == FTP_TRANSFER_RETR) {
+    transfer.file_fd = open(path.c_str(), O_RDONLY);
+    if (transfer.file_fd < 0) {
+      abort_transfer_setup(session, 550, "Failed to open file for reading");
+      return;
+    }
+  } else {
+    // STOR tronque sauf en reprise (REST), APPE écrit toujours en fin de fichier
+    int flags = O_WRONLY | O_CREAT;
+    if (kind == FTP_TRANSFER_APPE) {
+      flags |= O_APPEND;
+    } else if (offset == 0) {
+      flags |= O_TRUNC;
+    }
+    transfer.file_fd = open(path.c_str(), flags, 0666);
+    if (transfer.file_fd < 0) {
+      abort_transfer_setup(session, 550, "Failed to open file for writing");
+      return;
+    }
+    listing_cache_.invalidate(path);
+  }
+
+  if (offset > 0 && lseek(transfer.file_fd, offset, SEEK_SET) < 0) {
+    ESP_LOGE(TAG, "Failed to seek to %llu in %s (errno: %d)", (unsigned long long) offset, path.c_str(), errno);
+    abort_transfer_setup(session, 554, "Invalid REST parameter");
+    return;
+  }
+
+  if (is_upload(kind)) {
+    transfer.crc_inline = kind == FTP_TRANSFER_STOR && offset == 0;
+    transfer.upload_crc = 0;
+    uint64_t allocation = session.allocation_hint;
+    session.allocation_hint = 0;
+    if (session.upload_buffer == nullptr) {
+      session.upload_buffer = allocate_buffer(FTP_UPLOAD_CLUSTER_SIZE, &session.upload_buffer_internal);
+    }
+    // Sans tampon d'un cluster, le tampon de la session sert de repli (écritures non regroupées)
+    off_t position = kind == FTP_TRANSFER_APPE ? lseek(transfer.file_fd, 0, SEEK_END) : (off_t) offset;
+    if (session.upload_buffer != nullptr) {
+      session.upload.begin(transfer.file_fd, session.upload_buffer, FTP_UPLOAD_CLUSTER_SIZE, position);
+    } else {
+      session.upload.begin(transfer.file_fd, transfer.buffer, sizeof(transfer.buffer), position);
+    }
+    // En APPE, O_APPEND écrirait après la zone réservée : pas de préallocation
+    if (kind == FTP_TRANSFER_STOR && !session.upload.preallocate(allocation)) {
+      abort_transfer_setup(session, 552, "Insufficient storage space");
+      return;
+    }
+  }
+
+  if (session.data_mode == FTP_DATA_ACTIVE && !open_active_connection(session)) {
+    metrics_.add_data_connection_failure();
+    abort_transfer_setup(session, 425, "Can't open data connection");
+    return;
+  }
+
+  send_response(client_socket, 150, opening);
+
+  // La lecture commence pendant l'attente de la connexion de données
+  if (kind == FTP_TRANSFER_RETR && has_reader_task() &&
+      session.download.allocate(download_buffer_count_, download_buffer_size_)) {
+    session.download.start(transfer.file_fd);
+    wake_reader();
+  }
+
+  transfer.state = FTP_TRANSFER_WAIT_CONNECTION;
+  FTP_TRACE(FTP_TRACE_TRANSFER_BEGIN, session, 0, kind);
+  transfer.started_at = millis();
+}
+
+// Échec de start_transfer() avant la réponse 150 : rend ce qui a été pris pour le transfert
+void FTPServer::abort_transfer_setup(FTPSession &session, int code, const char *message) {
+  FTPTransfer &transfer = session.transfer;
+  if (transfer.file_fd >= 0) {
+    close(transfer.file_fd);
+    transfer.file_fd = -1;
+  }
+  if (transfer.dir != nullptr) {
+    closedir(transfer.dir);
+    transfer.dir = nullptr;
+  }
+  transfer.cached.reset();
+  close_data_connection(session);
+  compression_in_use_ -= session.zstream.end();
+  release_session_buffers(session, true);
+  transfer.kind = FTP_TRANSFER_NONE;
+  send_response(session.control_socket, code, message);
+}
+
+void FTPServer::step_transfer(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+
+  if (transfer.state == FTP_TRANSFER_WAIT_CONNECTION) {
+    int data_socket = accept_data_connection(session);
+    if (data_socket < 0) {
+      if (session.data_mode == FTP_DATA_ACTIVE) {
+        finish_transfer(session, 425, "Can't open data connection");
+      }
+      return;
+    }
+    transfer.data_socket = data_socket;
+    transfer.state = FTP_TRANSFER_ACTIVE;
+    transfer.shaping.reset();
+    transfer.throttle_ms = 0;
+    shaper_.begin_transfer(direction_of(transfer.kind));
+    transfer.shaped = true;
+
+    // Connexion établie : le transfert est confié à une tâche de travail si le pool existe.
+    // loop() ne touche plus à la session jusqu'à ce que l'état passe à DONE.
+    if (transfer_queue_.is_created()) {
+      transfer.offloaded = true;
+      if (transfer_queue_.send(&session)) {
+        return;
+      }
+      transfer.offloaded = false;
+    }
+  }
+
+  pump_transfer(session);
+  if (transfer.finished) {
+    finish_transfer(session, transfer.result_code, transfer.result_message);
+  }
+}
+
+void FTPServer::pump_transfer(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  uint64_t before = transfer.bytes_transferred;
+
+  // Un nombre borné de blocs par appel pour que les autres clients et composants progressent
+  transfer.throttle_ms = 0;
+  for (int chunk = 0; chunk < FTP_TRANSFER_CHUNKS_PER_LOOP; chunk++) {
+    uint64_t step_start = transfer.bytes_transferred;
+    if (transfer.shaped) {
+      // Crédit épuisé : le passage s'arrête, le socket n'est plus lu ni écrit jusqu'au délai
+      uint32_t now = millis();
+      transfer.throttle_ms = shaper_.delay_ms(transfer.shaping, direction_of(transfer.kind), now);
+      if (transfer.throttle_ms > 0) {
+        transfer.resume_at = now + transfer.throttle_ms;
+        break;
+      }
+    }
+    bool progress;
+    switch (transfer.kind) {
+      case FTP_TRANSFER_LIST:
+      case FTP_TRANSFER_NLST:
+      case FTP_TRANSFER_MLSD:
+        progress = step_directory(session);
+        break;
+      case FTP_TRANSFER_RETR:
+        progress = step_download(session);
+        break;
+      case FTP_TRANSFER_STOR:
+      case FTP_TRANSFER_APPE:
+        progress = step_upload(session);
+        break;
+      case FTP_TRANSFER_HASH:
+        progress = step_hash(session);
+        break;
+      default:
+        progress = false;
+        break;
+    }
+    if (transfer.shaped && transfer.bytes_transferred != step_start) {
+      shaper_.consume(transfer.shaping, direction_of(transfer.kind), transfer.bytes_transferred - step_start);
+    }
+    if (!progress || transfer.finished) {
+      break;
+    }
+  }
+
+  // Comptage une fois par passage plutôt qu'à chaque send()/recv()
+  uint32_t moved = transfer.bytes_transferred - before;
+  if (moved == 0 || transfer.kind == FTP_TRANSFER_HASH) {
+    return;
+  }
+  if (is_upload(transfer.kind)) {
+    metrics_.add_received(moved);
+  } else {
+    metrics_.add_sent(moved);
+    if (before == 0 && transfer.kind == FTP_TRANSFER_RETR) {
+      metrics_.record_ttfb(millis() - transfer.started_at);
+    }
+  }
+}
+
+void FTPServer::transfer_worker(void *arg) {
+  FTPServer *server = static_cast<FTPServer *>(arg);
+  FTPSession *sessions[FTP_MAX_SESSIONS];
+  size_t count = 0;
+  while (true) {
+    // Sans transfert en cours, la tâche dort sur la file ; sinon elle la relève à chaque tour
+    void *job;
+    while (count < FTP_MAX_SESSIONS && server->transfer_queue_.receive(job, count == 0 ? FTP_WAIT_FOREVER : 0)) {
+      sessions[count++] = static_cast<FTPSession *>(job);
+    }
+    server->run_transfers(sessions, count);
+  }
+}
+
+// Exécuté sur une tâche de travail : un select() sur les sockets de données de tous les
+// transferts confiés à la tâche, puis un passage borné de pump_transfer() par transfert
+// prêt. Un long RETR ne retient pas la tâche : les transferts confiés ensuite avancent en
+// même temps. Les transferts terminés sont retirés de sessions.
+void FTPServer::run_transfers(FTPSession **sessions, size_t &count) {
+  fd_set read_fds;
+  fd_set write_fds;
+  FD_ZERO(&read_fds);
+  FD_ZERO(&write_fds);
+  int max_fd = -1;
+  uint32_t wait_ms = FTP_WORKER_POLL_MS;
+  for (size_t i = 0; i < count; i++) {
+    FTPTransfer &transfer = sessions[i]->transfer;
+    if (transfer.throttle_ms > 0 || transfer.data_socket < 0) {
+      // Limité en débit : repris au plus tard à l'échéance du crédit, sans attendre le socket
+      wait_ms = std::min(wait_ms, transfer.throttle_ms);
+      continue;
+    }
+    FD_SET(transfer.data_socket, is_upload(transfer.kind) ? &read_fds : &write_fds);
+    max_fd = std::max(max_fd, transfer.data_socket);
+  }
+
+  if (max_fd < 0) {
+    delay(wait_ms);
+  } else {
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = wait_ms * 1000;
+    if (select(max_fd + 1, &read_fds, &write_fds, nullptr, &tv) < 0 && errno != EINTR) {
+      for (size_t i = 0; i < count; i++) {
+        complete_transfer(*sessions[i], 426, "Connection closed; transfer aborted");
+      }
+    }
+  }
+
+  size_t ready = 0;
+  bool progress = false;
+  for (size_t i = 0; i < count;) {
+    FTPSession &session = *sessions[i];
+    FTPTransfer &transfer = session.transfer;
+    if (!transfer.finished &&
+        (transfer.throttle_ms > 0 || transfer.data_socket < 0 || FD_ISSET(transfer.data_socket, &read_fds) ||
+         FD_ISSET(transfer.data_socket, &write_fds))) {
+      uint64_t before = transfer.bytes_transferred;
+      pump_transfer(session);
+      ready++;
+      progress |= transfer.bytes_transferred != before;
+    }
+    if (!transfer.finished) {
+      i++;
+      continue;
+    }
+    // Dernier accès de la tâche à la session : loop() peut ensuite la terminer et démarrer
+    // le transfert suivant
+    sessions[i] = sessions[--count];
+    transfer.state.store(FTP_TRANSFER_DONE, std::memory_order_release);
+  }
+
+  // Sockets prêts mais rien à envoyer : la tâche de lecture n'a pas encore rempli de bloc
+  if (ready > 0 && !progress) {
+    delay(1);
+  }
+}
+
+// Appelée par les étapes de transfert, éventuellement depuis une tâche de travail : seul le
+// résultat est noté ici. L'état DONE est publié par celui qui conduit le transfert une fois
+// l'étape terminée, la réponse et la libération des ressources sont faites par loop()
+void FTPServer::complete_transfer(FTPSession &session, int code, const char *message) {
+  FTPTransfer &transfer = session.transfer;
+  transfer.result_code = code;
+  transfer.result_message = message;
+  transfer.finished = true;
+}
+
+// Envoie la sortie compressée en attente ; faux si le socket est plein ou en erreur (errno)
+static bool drain_compressed(FTPSession &session) {
+  ZStream &stream = session.zstream;
+  const char *out;
+  size_t len;
+  while ((out = stream.pending(len)) != nullptr) {
+    int sent = send(session.transfer.data_socket, out, len, MSG_DONTWAIT);
+    if (sent < 0) {
+      return false;
+    }
+    stream.consume(sent);
+  }
+  return true;
+}
+
+// Envoi sur la connexion de données, compressé en MODE Z. Retourne le nombre d'octets
+// acceptés (avant compression), ou -1 avec errno positionné comme pour send()
+static int send_data(FTPSession &session, const char *data, size_t len) {
+  ZStream &stream = session.zstream;
+  if (!stream.is_active()) {
+    return send(session.transfer.data_socket, data, len, MSG_DONTWAIT);
+  }
+  if (!drain_compressed(session)) {
+    return -1;
+  }
+  size_t consumed;
+  if (!stream.deflate(data, len, consumed)) {
+    errno = EIO;
+    return -1;
+  }
+  // Un socket plein ici n'est pas une erreur : la sortie reste en attente pour l'appel suivant
+  if (!drain_compressed(session) && !would_block()) {
+    return -1;
+  }
+  return consumed;
+}
+
+// Termine le flux compressé avant la réponse 226 ; faux tant que tout n'est pas envoyé
+static bool finish_data(FTPSession &session, bool &failed) {
+  ZStream &stream = session.zstream;
+  if (!stream.is_active()) {
+    return true;
+  }
+  while (true) {
+    if (!drain_compressed(session)) {
+      failed = !would_block();
+      return false;
+    }
+    if (stream.is_done()) {
+      return true;
+    }
+    if (!stream.finish_deflate()) {
+      failed = true;
+      return false;
+    }
+  }
+}
+
+// Envoie le reste du tampon sur la connexion de données.
+// Retourne false si le socket est plein ou si le transfert a été interrompu.
+static bool flush_transfer_buffer(FTPSession &session, bool &failed) {
+  FTPTransfer &transfer = session.transfer;
+  while (transfer.buffer_pos < transfer.buffer_len) {
+    int sent = send_data(session, transfer.buffer + transfer.buffer_pos, transfer.buffer_len - transfer.buffer_pos);
+    if (sent < 0) {
+      failed = !would_block();
+      return false;
+    }
+    transfer.buffer_pos += sent;
+    transfer.bytes_transferred += sent;
+  }
+  transfer.buffer_pos = 0;
+  transfer.buffer_len = 0;
+  return true;
+}
+
+void FTPServer::complete_send(FTPSession &session, const char *message) {
+  bool failed = false;
+  if (finish_data(session, failed)) {
+    complete_transfer(session, 226, message);
+  } else if (failed) {
+    complete_transfer(session, 426, "Connection closed; transfer aborted");
+  }
+}
+
+bool FTPServer::step_cached_listing(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  const char *data = transfer.cached->data();
+
+  while (transfer.buffer_pos < transfer.buffer_len) {
+    int sent = send_data(session, data + transfer.buffer_pos, transfer.buffer_len - transfer.buffer_pos);
+    if (sent < 0) {
+      if (!would_block()) {
+        complete_transfer(session, 426, "Connection closed; transfer aborted");
+      }
+      return false;
+    }
+    transfer.buffer_pos += sent;
+    transfer.bytes_transferred += sent;
+  }
+  complete_send(session, "Directory send OK");
+  return false;
+}
+
+bool FTPServer::step_directory(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  if (transfer.cached != nullptr) {
+    return step_cached_listing(session);
+  }
+  char *output = session.listing_buffer;
+
+  // Le reliquat d'un envoi partiel est ramené en tête avant de rendre de nouvelles entrées
+  if (transfer.buffer_pos > 0) {
+    memmove(output, output + transfer.buffer_pos, transfer.buffer_len - transfer.buffer_pos);
+    transfer.buffer_len -= transfer.buffer_pos;
+    transfer.buffer_pos = 0;
+  }
+
+  size_t rendered = 0;
+  size_t rendered_from = transfer.buffer_len;
+  while (transfer.dir != nullptr && rendered < FTP_LISTING_ENTRIES_PER_STEP &&
+         FTP_LISTING_BUFFER_SIZE - transfer.buffer_len >= FTP_MAX_LISTING_ENTRY) {
+    struct dirent *entry = readdir(transfer.dir);
+    if (entry == nullptr) {
+      closedir(transfer.dir);
+      transfer.dir = nullptr;
+      break;
+    }
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    transfer.buffer_len += format_directory_entry(transfer.kind, transfer.path, entry->d_name,
+                                                  output + transfer.buffer_len,
+                                                  FTP_LISTING_BUFFER_SIZE - transfer.buffer_len);
+    rendered++;
+  }
+
+  if (transfer.capturing) {
+    transfer.capture.append(output + rendered_from, transfer.buffer_len - rendered_from);
+    if (transfer.capture.size() > listing_cache_.get_capacity() / 4) {
+      transfer.capturing = false;
+      transfer.capture = std::string();
+    }
+  }
+
+  // Segments complets uniquement tant que le listing n'est pas terminé ; si le client
+  // lit lentement, send() échoue en EAGAIN et le rendu reprend quand le socket se libère
+  size_t sendable = transfer.buffer_len;
+  if (transfer.dir != nullptr) {
+    sendable -= sendable % FTP_DATA_SEGMENT_SIZE;
+  }
+  while (transfer.buffer_pos < sendable) {
+    int sent = send_data(session, output + transfer.buffer_pos, sendable - transfer.buffer_pos);
+    if (sent < 0) {
+      if (!would_block()) {
+        complete_transfer(session, 426, "Connection closed; transfer aborted");
+      }
+      return false;
+    }
+    transfer.buffer_pos += sent;
+    transfer.bytes_transferred += sent;
+  }
+
+  if (transfer.dir == nullptr && transfer.buffer_pos == transfer.buffer_len) {
+    complete_send(session, "Directory send OK");
+  }
+  // Un lot par appel : le coût des stat() reste borné à chaque passage
+  return false;
+}
+
+void FTPServer::reader_task(void *arg) {
+  FTPServer *server = static_cast<FTPServer *>(arg);
+  while (true) {
+    // Réveillée par loop() quand un bloc se libère ; le délai rattrape une notification manquée
+    server->reader_task_.wait(50);
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      // Un bloc par session et par tour pour partager la carte entre les téléchargements
+      for (FTPSession &session : server->sessions_) {
+        if (session.download.fill()) {
+          progress = true;
+        }
+      }
+    }
+  }
+}
+
+void FTPServer::wake_reader() { reader_task_.notify(); }
+
+bool FTPServer::has_reader_task() const { return reader_task_.is_running(); }
+
+bool FTPServer::step_download(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  DownloadPipeline &pipeline = session.download;
+  if (!pipeline.is_active()) {
+    return step_download_direct(session);
+  }
+
+  const char *data;
+  size_t len;
+  if (!pipeline.peek(data, len)) {
+    if (pipeline.has_failed()) {
+      ESP_LOGE(TAG, "Failed to read file: %s", transfer.path.c_str());
+      complete_transfer(session, 451, "Local error in processing");
+    } else if (pipeline.is_finished()) {
+      complete_send(session, "Transfer complete");
+    }
+    return false;
+  }
+
+  int sent = send_data(session, data, len);
+  if (sent < 0) {
+    if (!would_block()) {
+      complete_transfer(session, 426, "Connection closed; transfer aborted");
+    }
+    return false;
+  }
+  transfer.bytes_transferred += sent;
+  if (pipeline.consume(sent)) {
+    wake_reader();
+  }
+  return true;
+}
+
+// Lecture synchrone depuis loop(), utilisée si la tâche de lecture ou ses tampons manquent
+bool FTPServer::step_download_direct(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  bool failed = false;
+
+  if (transfer.buffer_pos == transfer.buffer_len) {
+    int len = read(transfer.file_fd, transfer.buffer, sizeof(transfer.buffer));
+    if (len < 0) {
+      ESP_LOGE(TAG, "Failed to read file: %s (errno: %d)", transfer.path.c_str(), errno);
+      complete_transfer(session, 451, "Local error in processing");
+      return false;
+    }
+    if (len == 0) {
+      complete_send(session, "Transfer complete");
+      return false;
+    }
+    transfer.buffer_len = len;
+    transfer.buffer_pos = 0;
+  }
+
+  if (!flush_transfer_buffer(session, failed)) {
+    if (failed) {
+      complete_transfer(session, 426, "Connection closed; transfer aborted");
+    }
+    return false;
+  }
+  return true;
+}
+
+bool FTPServer::step_upload(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  UploadSink &sink = session.upload;
+  if (session.zstream.is_active()) {
+    return step_upload_compressed(session);
+  }
+
+  int len = recv(transfer.data_socket, sink.tail(), sink.space(), MSG_DONTWAIT);
+  if (len == 0) {
+    if (!sink.finish()) {
+      fail_upload(session);
+      return false;
+    }
+    complete_transfer(session, 226, "Transfer complete");
+    return false;
+  }
+  if (len < 0) {
+    if (!would_block()) {
+      complete_transfer(session, 426, "Connection closed; transfer aborted");
+    }
+    return false;
+  }
+
+  transfer.bytes_transferred += len;
+  if (transfer.crc_inline) {
+    transfer.upload_crc = Crc32::update(transfer.upload_crc, sink.tail(), len);
+  }
+  if (!sink.commit(len)) {
+    fail_upload(session);
+    return false;
+  }
+  return true;
+}
+
+bool FTPServer::step_upload_compressed(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  UploadSink &sink = session.upload;
+  ZStream &stream = session.zstream;
+
+  // La sortie décompressée en attente passe d'abord dans le tampon d'écriture
+  const char *out;
+  size_t len;
+  while ((out = stream.pending(len)) != nullptr) {
+    size_t count = std::min(len, sink.space());
+    memcpy(sink.tail(), out, count);
+    stream.consume(count);
+    if (transfer.crc_inline) {
+      transfer.upload_crc = Crc32::update(transfer.upload_crc, out, count);
+    }
+    transfer.bytes_transferred += count;
+    if (!sink.commit(count)) {
+      fail_upload(session);
+      return false;
+    }
+  }
+
+  if (!stream.has_input()) {
+    int received = recv(transfer.data_socket, stream.input_tail(), stream.input_space(), MSG_DONTWAIT);
+    if (received == 0) {
+      if (!stream.is_done()) {
+        complete_transfer(session, 451, "Compressed data truncated");
+      } else if (!sink.finish()) {
+        fail_upload(session);
+      } else {
+        complete_transfer(session, 226, "Transfer complete");
+      }
+      return false;
+    }
+    if (received < 0) {
+      if (!would_block()) {
+        complete_transfer(session, 426, "Connection closed; transfer aborted");
+      }
+      return false;
+    }
+    stream.commit_input(received);
+  }
+
+  if (!stream.inflate()) {
+    complete_transfer(session, 451, "Invalid compressed data");
+    return false;
+  }
+  return true;
+}
+
+bool FTPServer::step_hash(FTPSession &session) {
+  FTPTransfer &transfer = session.transfer;
+  DownloadPipeline &pipeline = session.download;
+  const char *data;
+  size_t len;
+
+  if (pipeline.is_active()) {
+    if (!pipeline.peek(data, len)) {
+      if (pipeline.has_failed()) {
+        complete_transfer(session, 451, "Local error in processing");
+      } else if (pipeline.is_finished()) {
+        transfer.hash_digest = transfer.hash.finish();
+        complete_transfer(session, 250, "");
+      }
+      return false;
+    }
+    transfer.hash.update(data, len);
+    if (pipeline.consume(len)) {
+      wake_reader();
+    }
+  } else {
+    int count = read(transfer.file_fd, transfer.buffer, sizeof(transfer.buffer));
+    if (count < 0) {
+      complete_transfer(session, 451, "Local error in processing");
+      return false;
+    }
+    if (count == 0) {
+      transfer.hash_digest = transfer.hash.finish();
+      complete_transfer(session, 250, "");
+      return false;
+    }
+    len = count;
+    transfer.hash.update(transfer.buffer, len);
+  }
+  transfer.bytes_transferred += len;
+  return true;
+}
+
+void FTPServer::fail_upload(FTPSession &session) {
+  int error = session.upload.get_error();
+  ESP_LOGE(TAG, "Failed to write file: %s (errno: %d)", session.transfer.path.c_str(), error);
+  if (error == ENOSPC) {
+    complete_transfer(session, 552, "Requested file action aborted. Exceeded storage allocation");
+  } else {
+    complete_transfer(session, 451, "Local error in processing");
+  }
+}
+
+void FTPServer::finish_transfer(FTPSession &session, int code, const std::string& message) {
+  FTPTransfer &transfer = session.transfer;
+  FTP_TRACE(FTP_TRACE_TRANSFER_END, session, 0, code, transfer.bytes_transferred);
+  if (transfer.shaped) {
+    shaper_.end_transfer(direction_of(transfer.kind));
+    transfer.shaped = false;
+  }
+  session.download.stop();
+  // Sur abandon, les données déjà reçues sont écrites pour qu'un REST puisse reprendre
+  if (is_upload(transfer.kind) && transfer.file_fd >= 0) {
+    session.upload.finish();
+  }
+
+  if (transfer.file_fd >= 0) {
+    close(transfer.file_fd);
+    transfer.file_fd = -1;
+  }
+  if (transfer.dir != nullptr) {
+    closedir(transfer.dir);
+    transfer.dir = nullptr;
+  }
+  if (transfer.data_socket >= 0) {
+    close(transfer.data_socket);
+    transfer.data_socket = -1;
+  }
+  // Un calcul d'empreinte n'a pas consommé le PASV/PORT éventuellement en attente
+  if (transfer.kind != FTP_TRANSFER_HASH) {
+    close_data_connection(session);
+  }
+
+  // La taille et la date du fichier reçu ont changé, même si l'envoi a échoué
+  if (is_upload(transfer.kind)) {
+    listing_cache_.invalidate(transfer.path);
+    digest_cache_.invalidate(transfer.path);
+    struct stat file_stat;
+    if (code == 226 && transfer.crc_inline && stat(transfer.path.c_str(), &file_stat) == 0) {
+      char crc[9];
+      snprintf(crc, sizeof(crc), "%08x", (unsigned) transfer.upload_crc);
+      digest_cache_.insert(transfer.path, HASH_CRC32, file_stat.st_size, file_stat.st_mtime, crc);
+    }
+  }
+  bool hash_reply = transfer.kind == FTP_TRANSFER_HASH && code == 250;
+  if (hash_reply) {
+    digest_cache_.insert(transfer.path, transfer.hash.get_algorithm(), transfer.hash_size, transfer.hash_mtime,
+                         transfer.hash_digest);
+  }
+  transfer.hash.reset();
+  if (code == 226 && transfer.capturing) {
+    listing_cache_.insert(transfer.kind, transfer.path, std::move(transfer.capture), transfer.cache_generation);
+  }
+  transfer.cached.reset();
+  transfer.capture = std::string();
+  transfer.capturing = false;
+  compression_in_use_ -= session.zstream.end();
+  release_session_buffers(session, true);
+
+  if (code == 425) {
+    metrics_.add_data_connection_failure();
+  }
+#ifdef USE_TEXT_SENSOR
+  if (last_transfer_text_sensor_ != nullptr) {
+    static const char *const KIND_NAMES[] = {"", "LIST", "NLST", "MLSD", "RETR", "STOR", "APPE", "HASH"};
+    last_transfer_ = std::string(KIND_NAMES[transfer.kind]) + " " + transfer.path + " " + std::to_string(code) +
+                     " (" + std::to_string(transfer.bytes_transferred) + " bytes)";
+  }
+#endif
+
+  transfer.kind = FTP_TRANSFER_NONE;
+  transfer.state = FTP_TRANSFER_IDLE;
+  transfer.offloaded = false;
+  transfer.buffer_len = 0;
+  transfer.buffer_pos = 0;
+  if (hash_reply) {
+    send_hash_reply(session, transfer.hash_command, transfer.hash.get_algorithm(), transfer.path, transfer.hash_size,
+                    transfer.hash_digest);
+  } else {
+    send_response(session.control_socket, code, message);
+  }
+}
+
+void FTPServer::publish_metrics() {
+  FTPMetrics::Snapshot snapshot;
+  metrics_.collect(snapshot);
+  uint32_t now = millis();
+#ifdef USE_SENSOR
+  float elapsed = (now - metrics_published_at_) / 1000.0f;
+#endif
+  metrics_published_at_ = now;
+  total_sent_ += snapshot.sent;
+  total_received_ += snapshot.received;
+  total_data_connection_failures_ += snapshot.data_connection_failures;
+
+#ifdef USE_SENSOR
+  size_t transfers = 0;
+  for (const auto &session : sessions_) {
+    if (session.in_use() && session.transfer.state != FTP_TRANSFER_IDLE) {
+      transfers++;
+    }
+  }
+  if (active_sessions_sensor_ != nullptr)
+    active_sessions_sensor_->publish_state(FTP_MAX_SESSIONS - free_slot_count_);
+  if (active_transfers_sensor_ != nullptr)
+    active_transfers_sensor_->publish_state(transfers);
+  if (elapsed > 0 && send_rate_sensor_ != nullptr)
+    send_rate_sensor_->publish_state(snapshot.sent / elapsed);
+  if (elapsed > 0 && receive_rate_sensor_ != nullptr)
+    receive_rate_sensor_->publish_state(snapshot.received / elapsed);
+  if (bytes_sent_sensor_ != nullptr)
+    bytes_sent_sensor_->publish_state(total_sent_);
+  if (bytes_received_sensor_ != nullptr)
+    bytes_received_sensor_->publish_state(total_received_);
+  if (data_connection_failures_sensor_ != nullptr)
+    data_connection_failures_sensor_->publish_state(total_data_connection_failures_);
+  // Sans téléchargement pendant l'intervalle, la dernière valeur publiée est conservée
+  if (snapshot.ttfb_count > 0 && ttfb_p50_sensor_ != nullptr)
+    ttfb_p50_sensor_->publish_state(FTPMetrics::ttfb_percentile(snapshot, 0.5f));
+  if (snapshot.ttfb_count > 0 && ttfb_p99_sensor_ != nullptr)
+    ttfb_p99_sensor_->publish_state(FTPMetrics::ttfb_percentile(snapshot, 0.99f));
+#endif
+#ifdef USE_TEXT_SENSOR
+  if (last_transfer_text_sensor_ != nullptr && last_transfer_text_sensor_->state != last_transfer_)
+    last_transfer_text_sensor_->publish_state(last_transfer_);
+#endif
+}
+
+void FTPServer::dump_trace() {
+#ifndef USE_FTP_SERVER_TRACE
+  ESP_LOGW(TAG, "Tracing is disabled, set trace_events to enable it");
+#else
+  static const char *const TYPE_NAMES[] = {"connect", "disconnect", "command", "reply", "transfer", "done"};
+  static const char *const KIND_NAMES[] = {"", "LIST", "NLST", "MLSD", "RETR", "STOR", "APPE", "HASH"};
+  ESP_LOGI(TAG, "Trace (%u events max):", (unsigned) trace_.capacity());
+  size_t count = trace_.for_each([](const FTPTraceEvent &event) {
+    const char *type = event.type <= FTP_TRACE_TRANSFER_END ? TYPE_NAMES[event.type] : "?";
+    switch (event.type) {
+      case FTP_TRACE_COMMAND: {
+        // Le verbe encodé est relu octet par octet, poids fort en premier
+        char verb[9];
+        for (int i = 0; i < 8; i++) {
+          verb[i] = static_cast<char>(event.verb >> (56 - 8 * i));
+        }
+        verb[8] = '\0';
+        ESP_LOGI(TAG, "  %10u us  s%u %-10s %s", (unsigned) event.timestamp_us, event.session, type, verb);
+        break;
+      }
+      case FTP_TRACE_TRANSFER_BEGIN:
+        ESP_LOGI(TAG, "  %10u us  s%u %-10s %s", (unsigned) event.timestamp_us, event.session, type,
+                 event.status <= FTP_TRANSFER_HASH ? KIND_NAMES[event.status] : "?");
+        break;
+      case FTP_TRACE_TRANSFER_END:
+        ESP_LOGI(TAG, "  %10u us  s%u %-10s %u, %u bytes", (unsigned) event.timestamp_us, event.session, type,
+                 event.status, (unsigned) event.bytes);
+        break;
+      case FTP_TRACE_REPLY:
+        ESP_LOGI(TAG, "  %10u us  s%u %-10s %u", (unsigned) event.timestamp_us, event.session, type, event.status);
+        break;
+      default:
+        ESP_LOGI(TAG, "  %10u us  s%u %s", (unsigned) event.timestamp_us, event.session, type);
+        break;
+    }
+  });
+  ESP_LOGI(TAG, "%u events", (unsigned) count);
+#endif
+}
+
+bool FTPServer::has_active_transfers() const {
+  uint32_t now = millis();
+  for (const auto &session : sessions_) {
+    // Un transfert confié à une tâche de travail, ou en attente de crédit, n'a pas besoin
+    // que loop() tourne en continu
+    if (session.in_use() && session.transfer.state != FTP_TRANSFER_IDLE && !session.transfer.offloaded &&
+        !is_throttled(session.transfer, now)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 bool FTPServer::is_running() const {
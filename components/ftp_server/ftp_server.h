@@ -1,12 +1,44 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/automation.h"
+#include "listing_cache.h"
+#include "download_pipeline.h"
+#include "upload_sink.h"
+#include "zstream.h"
+#include "ftp_metrics.h"
+#include "file_hash.h"
+#include "digest_cache.h"
+#include "passive_port_pool.h"
+#include "bandwidth_shaper.h"
+#include "path_resolver.h"
+#include "ftp_trace.h"
+#include "ftp_tasks.h"
+#include <atomic>
+#include <deque>
 #include <string>
 #include <vector>
+#include <dirent.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_TEXT_SENSOR
+#include "esphome/components/text_sensor/text_sensor.h"
+#endif
+
+#ifdef USE_ESP_IDF
+#include "esp_event.h"
+#endif
+
+#ifdef USE_FTP_SERVER_SD_MMC
+#include "../sd_mmc_card/sd_mmc_card.h"
+#endif
+
 namespace esphome {
 namespace ftp_server {
 
@@ -15,7 +47,182 @@ enum FTPClientState {
   FTP_LOGGED_IN
 };
 
+enum FTPTransferKind {
+  FTP_TRANSFER_NONE,
+  FTP_TRANSFER_LIST,
+  FTP_TRANSFER_NLST,
+  FTP_TRANSFER_MLSD,
+  FTP_TRANSFER_RETR,
+  FTP_TRANSFER_STOR,
+  FTP_TRANSFER_APPE,
+  FTP_TRANSFER_HASH  // empreinte d'un fichier, sans connexion de données
+};
+
+inline bool is_upload(FTPTransferKind kind) { return kind == FTP_TRANSFER_STOR || kind == FTP_TRANSFER_APPE; }
+inline FTPDirection direction_of(FTPTransferKind kind) {
+  return is_upload(kind) ? FTP_DIRECTION_UPLOAD : FTP_DIRECTION_DOWNLOAD;
+}
+
+enum FTPTransferState {
+  FTP_TRANSFER_IDLE,
+  FTP_TRANSFER_WAIT_CONNECTION,
+  FTP_TRANSFER_ACTIVE,
+  FTP_TRANSFER_DONE  // terminé, réponse et nettoyage en attente dans loop()
+};
+
+// Taille d'un bloc de transfert et nombre de blocs traités par client à chaque loop()
+static const size_t FTP_TRANSFER_CHUNK_SIZE = 2048;
+static const int FTP_TRANSFER_CHUNKS_PER_LOOP = 32;
+static const uint32_t FTP_DATA_CONNECTION_TIMEOUT_MS = 5000;
+
+// Les listings sont rendus dans un grand tampon (PSRAM si disponible) puis envoyés par
+// multiples de la taille de segment TCP de lwIP plutôt qu'un send() par entrée
+static const size_t FTP_LISTING_BUFFER_SIZE = 16 * 1024;
+static const size_t FTP_MAX_LISTING_ENTRY = 600;
+static const size_t FTP_LISTING_ENTRIES_PER_STEP = 64;
+static const size_t FTP_DATA_SEGMENT_SIZE = 1436;
+
+// Un listing plus gros qu'un quart du cache n'y est pas conservé
+static const size_t FTP_LISTING_CACHE_DEFAULT_SIZE = 32 * 1024;
+
+// Pipeline RETR : nombre et taille des blocs remplis par la tâche de lecture
+static const size_t FTP_DOWNLOAD_BUFFER_COUNT = 2;
+static const size_t FTP_DOWNLOAD_BUFFER_SIZE = 32 * 1024;
+
+// Pool de tâches exécutant les transferts hors de la tâche principale d'ESPHome. Une tâche
+// conduit tous les transferts qui lui sont confiés ; elle relève les nouveaux au plus toutes
+// les FTP_WORKER_POLL_MS pendant qu'elle en attend d'autres dans select()
+static const size_t FTP_TRANSFER_WORKERS = 1;
+static const size_t FTP_MAX_TRANSFER_WORKERS = 4;
+static const uint32_t FTP_WORKER_POLL_MS = 10;
+static const int FTP_TRANSFER_WORKER_CORE = 0;
+static const int FTP_TRANSFER_WORKER_PRIORITY = 5;
+
+// MODE Z : mémoire de travail totale autorisée pour les flux zlib de toutes les sessions
+static const size_t FTP_COMPRESSION_MEMORY = 384 * 1024;
+static const int FTP_COMPRESSION_LEVEL = 6;
+
+// Transfert en cours sur la connexion de données, avancé d'un bloc à la fois par loop()
+struct FTPTransfer {
+  FTPTransferKind kind{FTP_TRANSFER_NONE};
+  // Partagé avec la tâche de travail qui exécute le transfert : elle publie DONE (release)
+  // en tout dernier, après quoi seul loop() (acquire) touche de nouveau au transfert
+  std::atomic<FTPTransferState> state{FTP_TRANSFER_IDLE};
+  bool offloaded{false};
+  // Positionnés par complete_transfer(), lus par celui qui conduit le transfert
+  bool finished{false};
+  int result_code{0};
+  std::string result_message;
+  std::string path;
+  int data_socket{-1};
+  int file_fd{-1};
+  DIR *dir{nullptr};
+  uint32_t started_at{0};
+  uint64_t offset{0};
+  uint64_t bytes_transferred{0};
+  size_t buffer_len{0};
+  size_t buffer_pos{0};
+  char buffer[FTP_TRANSFER_CHUNK_SIZE];
+  // Listing servi depuis le cache, ou copie du rendu en vue de sa mise en cache
+  ListingCache::Listing cached;
+  std::string capture;
+  bool capturing{false};
+  uint32_t cache_generation{0};
+  // HASH/XCRC/XMD5/XSHA256 : contexte, forme de la réponse et fichier au moment du calcul
+  FileHash hash;
+  bool hash_command{false};
+  uint64_t hash_size{0};
+  int64_t hash_mtime{0};
+  std::string hash_digest;
+  // CRC calculé au fil d'un STOR complet, pour qu'un XCRC suivant ne relise pas le fichier
+  bool crc_inline{false};
+  uint32_t upload_crc{0};
+  // Limitation de débit : seau de la session, compté dans les parts équitables tant que shaped
+  TokenBucket shaping;
+  bool shaped{false};
+  uint32_t throttle_ms{0};  // attente demandée par le dernier passage, 0 si non limité
+  uint32_t resume_at{0};    // millis() de la fin de cette attente
+};
+
+// Mode de la prochaine connexion de données : écoute passive (PASV/EPSV) ou connexion active (PORT/EPRT)
+enum FTPDataMode {
+  FTP_DATA_NONE,
+  FTP_DATA_PASSIVE,
+  FTP_DATA_ACTIVE
+};
+
+static const size_t FTP_MAX_SESSIONS = 8;
+static const size_t FTP_MAX_COMMAND_LENGTH = 512;
+
+// État complet d'un client : connexion de contrôle, écoute passive, répertoire courant,
+// renommage en attente et curseur de transfert. Les sessions vivent dans un tableau
+// de taille fixe et sont passées par référence, sans recherche par socket.
+struct FTPSession {
+  int control_socket{-1};
+  FTPClientState state{FTP_WAIT_LOGIN};
+  std::string username;
+  std::string current_path;
+  std::string rename_from;
+  uint64_t restart_offset{0};  // positionné par REST, consommé par le prochain RETR/STOR
+  uint64_t allocation_hint{0};  // taille annoncée par ALLO, consommée par le prochain STOR
+  FTPDataMode data_mode{FTP_DATA_NONE};
+  bool epsv_all{false};
+  int passive_socket{-1};
+  uint16_t passive_port{0};
+  struct sockaddr_in active_address{};
+  FTPTransfer transfer;
+  char *listing_buffer{nullptr};  // alloué au premier listing, réutilisé jusqu'à la fin de la session
+  bool listing_buffer_internal{false};  // hors PSRAM : rendu à la fin de chaque transfert
+  DownloadPipeline download;      // blocs alloués au premier RETR
+  char *upload_buffer{nullptr};   // un cluster, alloué au premier STOR/APPE
+  bool upload_buffer_internal{false};  // hors PSRAM : rendu à la fin de chaque transfert
+  UploadSink upload;
+  bool mode_z{false};             // MODE Z : transferts compressés en zlib
+  ZStream zstream;                // alloué pour la durée d'un transfert en MODE Z
+
+  // Assemblage incrémental des lignes de commande : les octets reçus s'accumulent dans
+  // line_buffer et chaque ligne complète est mise en file, ce qui permet le pipelining.
+  char line_buffer[FTP_MAX_COMMAND_LENGTH];
+  size_t line_length{0};
+  bool line_overflow{false};
+  std::deque<std::string> pending_commands;
+
+  bool in_use() const { return control_socket >= 0; }
+};
+
+class FTPServer;
+
+// Nature de l'argument attendu par un verbe, analysé une seule fois avant l'appel du handler
+enum FTPArgumentKind : uint8_t {
+  FTP_ARG_NONE,      // argument ignoré
+  FTP_ARG_OPTIONAL,  // texte brut, éventuellement vide
+  FTP_ARG_TEXT,      // texte brut obligatoire (501 sinon)
+  FTP_ARG_PATH,      // chemin obligatoire, résolu depuis le répertoire courant
+  FTP_ARG_LIST       // chemin optionnel après les options "-la", répertoire courant par défaut
+};
+
+struct FTPCommand {
+  uint64_t verb;
+  void (FTPServer::*handler)(FTPSession &session, const std::string &argument);
+  bool login_required;
+  FTPArgumentKind argument;
+};
+
 class FTPServer : public Component {
+#ifdef USE_SENSOR
+  SUB_SENSOR(active_sessions)
+  SUB_SENSOR(active_transfers)
+  SUB_SENSOR(send_rate)
+  SUB_SENSOR(receive_rate)
+  SUB_SENSOR(bytes_sent)
+  SUB_SENSOR(bytes_received)
+  SUB_SENSOR(data_connection_failures)
+  SUB_SENSOR(ttfb_p50)
+  SUB_SENSOR(ttfb_p99)
+#endif
+#ifdef USE_TEXT_SENSOR
+  SUB_TEXT_SENSOR(last_transfer)
+#endif
  public:
   FTPServer();
   void setup() override;
@@ -31,45 +238,210 @@ class FTPServer : public Component {
   void set_username(const std::string &username) { username_ = username; }
   void set_password(const std::string &password) { password_ = password; }
   void set_root_path(const std::string &root_path) { root_path_ = root_path; }
+  void set_listing_cache_size(size_t size) { listing_cache_.set_capacity(size); }
+  void set_download_buffer_count(size_t count) { download_buffer_count_ = count; }
+  void set_download_buffer_size(size_t size) { download_buffer_size_ = size; }
+  void set_transfer_workers(size_t count) { transfer_worker_count_ = count; }
+  void set_transfer_worker_core(int core) { transfer_worker_core_ = core; }
+  void set_transfer_worker_priority(int priority) { transfer_worker_priority_ = priority; }
+  void set_compression_memory(size_t memory) { compression_memory_ = memory; }
+  void set_compression_level(int level) { compression_level_ = level; }
+  void set_metrics_interval(uint32_t interval) { metrics_interval_ = interval; }
+  // Débits en octets par seconde, 0 : illimité ; modifiables à l'exécution par les actions
+  void set_global_rate(FTPDirection direction, uint32_t rate) { shaper_.set_global_rate(direction, rate); }
+  void set_session_rate(FTPDirection direction, uint32_t rate) { shaper_.set_session_rate(direction, rate); }
+  void set_fair_share(bool fair_share) { shaper_.set_fair_share(fair_share); }
+#ifdef USE_FTP_SERVER_TRACE
+  void set_trace_events(size_t events) { trace_events_ = events; }
+#endif
+  // Écrit le contenu de l'anneau de traces dans le journal ; le formatage n'a lieu qu'ici
+  void dump_trace();
+  void set_passive_ports(uint16_t first, uint16_t last) {
+    passive_port_first_ = first;
+    passive_port_last_ = last;
+  }
+#ifdef USE_FTP_SERVER_SD_MMC
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *card);
+#endif
 
   // Méthode pour vérifier si le serveur est en cours d'exécution
   bool is_running() const;
 
  protected:
   void handle_new_clients();
-  void handle_ftp_client(int client_socket);
-  void process_command(int client_socket, const std::string& command);
+  void handle_ftp_client(FTPSession &session);
+  void assemble_command_lines(FTPSession &session, const char *data, size_t len);
+  void run_pending_commands(FTPSession &session);
+  void process_command(FTPSession &session, const std::string& command);
+  // Résout request dans resolved_path_ ; répond 553 et retourne faux si le chemin est trop long
+  bool resolve_path(FTPSession &session, const std::string &request);
   void send_response(int client_socket, int code, const std::string& message);
   bool authenticate(const std::string& username, const std::string& password);
-  void list_directory(int client_socket, const std::string& path);
-  void list_names(int client_socket, const std::string& path);  // Add this line
-  void start_file_upload(int client_socket, const std::string& path);
-  void start_file_download(int client_socket, const std::string& path);
+  void close_session(FTPSession &session);
+  void release_session_buffers(FTPSession &session, bool internal_only);
+
+  // Handlers des verbes FTP, référencés par la table COMMANDS
+  static const FTPCommand COMMANDS[];
+  void cmd_allo(FTPSession &session, const std::string &size);
+  void cmd_user(FTPSession &session, const std::string &username);
+  void cmd_pass(FTPSession &session, const std::string &password);
+  void cmd_syst(FTPSession &session, const std::string &);
+  void cmd_feat(FTPSession &session, const std::string &);
+  void cmd_type(FTPSession &session, const std::string &type);
+  void cmd_pwd(FTPSession &session, const std::string &);
+  void cmd_cwd(FTPSession &session, const std::string &path);
+  void cmd_cdup(FTPSession &session, const std::string &);
+  void cmd_pasv(FTPSession &session, const std::string &);
+  void cmd_epsv(FTPSession &session, const std::string &argument);
+  void cmd_port(FTPSession &session, const std::string &argument);
+  void cmd_eprt(FTPSession &session, const std::string &argument);
+  void cmd_list(FTPSession &session, const std::string &path);
+  void cmd_nlst(FTPSession &session, const std::string &path);
+  void cmd_mlsd(FTPSession &session, const std::string &path);
+  void cmd_mlst(FTPSession &session, const std::string &path);
+  void cmd_mode(FTPSession &session, const std::string &mode);
+  void cmd_hash(FTPSession &session, const std::string &path);
+  void cmd_xcrc(FTPSession &session, const std::string &path);
+  void cmd_xmd5(FTPSession &session, const std::string &path);
+  void cmd_xsha256(FTPSession &session, const std::string &path);
+  void cmd_stor(FTPSession &session, const std::string &path);
+  void cmd_appe(FTPSession &session, const std::string &path);
+  void cmd_rest(FTPSession &session, const std::string &offset);
+  void cmd_retr(FTPSession &session, const std::string &path);
+  void cmd_dele(FTPSession &session, const std::string &path);
+  void cmd_mkd(FTPSession &session, const std::string &path);
+  void cmd_rmd(FTPSession &session, const std::string &path);
+  void cmd_rnfr(FTPSession &session, const std::string &path);
+  void cmd_rnto(FTPSession &session, const std::string &path);
+  void cmd_size(FTPSession &session, const std::string &path);
+  void cmd_mdtm(FTPSession &session, const std::string &path);
+  void cmd_noop(FTPSession &session, const std::string &);
+  void cmd_quit(FTPSession &session, const std::string &);
+
+  // Machine à états des transferts
+  void start_transfer(FTPSession &session, FTPTransferKind kind, const std::string& path,
+                      const std::string &opening, uint64_t offset = 0);
+  void abort_transfer_setup(FTPSession &session, int code, const char *message);
+  void step_transfer(FTPSession &session);
+  void pump_transfer(FTPSession &session);
+  void complete_transfer(FTPSession &session, int code, const char *message);
+  void complete_send(FTPSession &session, const char *message);
+  static void transfer_worker(void *arg);
+  void run_transfers(FTPSession **sessions, size_t &count);
+  bool step_directory(FTPSession &session);
+  bool step_cached_listing(FTPSession &session);
+  bool step_download(FTPSession &session);
+  bool step_download_direct(FTPSession &session);
+  static void reader_task(void *arg);
+  void wake_reader();
+  bool has_reader_task() const;
+  bool step_upload(FTPSession &session);
+  bool step_upload_compressed(FTPSession &session);
+  void start_hash(FTPSession &session, const std::string &path, HashAlgorithm algorithm, bool hash_command);
+  bool step_hash(FTPSession &session);
+  void send_hash_reply(FTPSession &session, bool hash_command, HashAlgorithm algorithm, const std::string &path,
+                       uint64_t size, const std::string &digest);
+  std::string client_path(const std::string &path) const;
+  void fail_upload(FTPSession &session);
+  void finish_transfer(FTPSession &session, int code, const std::string& message);
+  bool has_active_transfers() const;
+  uint8_t session_id(const FTPSession &session) const { return &session - sessions_; }
+  void publish_metrics();
+
+  // Méthodes pour les connexions de données passives et actives
+  bool open_passive_listener(FTPSession &session);
+  bool get_advertised_ip(uint32_t &ip);
+#ifdef USE_ESP_IDF
+  static void ip_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data);
+#endif
+  bool set_active_address(FTPSession &session, uint32_t ip, uint16_t port);
+  bool open_active_connection(FTPSession &session);
+  int accept_data_connection(FTPSession &session);
+  void close_data_connection(FTPSession &session);
 
   uint16_t port_{21};
   std::string username_{"admin"};
   std::string password_{"admin"};
   std::string root_path_{"/sdcard"};
-  std::string current_path_;
   int ftp_server_socket_{-1};
-  std::vector<int> client_sockets_;
-  std::vector<FTPClientState> client_states_;
-  std::vector<std::string> client_usernames_;
-  std::vector<std::string> client_current_paths_;
-
-  // Variables pour le mode passif
-  bool passive_mode_enabled_ = false;
-  int passive_data_socket_ = -1;
-  int passive_data_port_ = -1;
-  std::string passive_client_ip_;
-
-  // Variable pour la commande RNFR
-  std::string rename_from_;  // Add this line
-
-  // Méthodes pour le mode passif
-  bool start_passive_mode(int client_socket);
-  int open_data_connection(int client_socket);
-  void close_data_connection(int client_socket);
+  HighFrequencyLoopRequester high_freq_;
+  PathResolver path_resolver_;
+  std::string resolved_path_;  // dernier chemin résolu, passé aux handlers par référence
+  ListingCache listing_cache_;
+  DigestCache digest_cache_;
+  size_t download_buffer_count_{FTP_DOWNLOAD_BUFFER_COUNT};
+  size_t download_buffer_size_{FTP_DOWNLOAD_BUFFER_SIZE};
+  size_t transfer_worker_count_{FTP_TRANSFER_WORKERS};
+  int transfer_worker_core_{FTP_TRANSFER_WORKER_CORE};
+  int transfer_worker_priority_{FTP_TRANSFER_WORKER_PRIORITY};
+  size_t compression_memory_{FTP_COMPRESSION_MEMORY};
+  int compression_level_{FTP_COMPRESSION_LEVEL};
+  size_t compression_in_use_{0};
+  // Plage de ports passifs pré-ouverts ; 0 : un port éphémère par PASV/EPSV
+  uint16_t passive_port_first_{0};
+  uint16_t passive_port_last_{0};
+  PassivePortPool passive_ports_;
+  BandwidthShaper shaper_;
+  // Adresse annoncée par PASV, relue sur la netif seulement après un événement IP
+  uint32_t advertised_ip_{0};
+  std::atomic<bool> advertised_ip_stale_{true};
+
+  FTPMetrics metrics_;
+#ifdef USE_FTP_SERVER_TRACE
+  FTPTrace trace_;
+  size_t trace_events_{256};
+#endif
+  uint32_t metrics_interval_{0};
+  uint32_t metrics_published_at_{0};
+  uint64_t total_sent_{0};
+  uint64_t total_received_{0};
+  uint32_t total_data_connection_failures_{0};
+  std::string last_transfer_;
+  FTPTask reader_task_;
+  FTPTask transfer_tasks_[FTP_MAX_TRANSFER_WORKERS];
+  FTPJobQueue transfer_queue_;
+
+  // Sessions allouées dans un tableau fixe ; free_slots_ est une pile d'indices libres
+  FTPSession sessions_[FTP_MAX_SESSIONS];
+  uint8_t free_slots_[FTP_MAX_SESSIONS];
+  size_t free_slot_count_{0};
+};
+
+template<typename... Ts> class FTPServerSetBandwidthAction : public Action<Ts...> {
+ public:
+  FTPServerSetBandwidthAction(FTPServer *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(uint32_t, download)
+  TEMPLATABLE_VALUE(uint32_t, upload)
+  TEMPLATABLE_VALUE(uint32_t, session_download)
+  TEMPLATABLE_VALUE(uint32_t, session_upload)
+  TEMPLATABLE_VALUE(bool, fair_share)
+
+  // Seules les limites présentes dans l'action sont modifiées
+  void play(Ts... x) {
+    if (this->download_.has_value())
+      this->parent_->set_global_rate(FTP_DIRECTION_DOWNLOAD, this->download_.value(x...));
+    if (this->upload_.has_value())
+      this->parent_->set_global_rate(FTP_DIRECTION_UPLOAD, this->upload_.value(x...));
+    if (this->session_download_.has_value())
+      this->parent_->set_session_rate(FTP_DIRECTION_DOWNLOAD, this->session_download_.value(x...));
+    if (this->session_upload_.has_value())
+      this->parent_->set_session_rate(FTP_DIRECTION_UPLOAD, this->session_upload_.value(x...));
+    if (this->fair_share_.has_value())
+      this->parent_->set_fair_share(this->fair_share_.value(x...));
+  }
+
+ protected:
+  FTPServer *parent_;
+};
+
+template<typename... Ts> class FTPServerDumpTraceAction : public Action<Ts...> {
+ public:
+  FTPServerDumpTraceAction(FTPServer *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->dump_trace(); }
+
+ protected:
+  FTPServer *parent_;
 };
 
 }  // namespace ftp_server
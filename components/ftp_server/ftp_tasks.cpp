@@ -0,0 +1,129 @@
+#include "ftp_tasks.h"
+
+#ifndef USE_ESP_IDF
+#include <chrono>
+#include <thread>
+#endif
+
+namespace esphome {
+namespace ftp_server {
+
+#ifdef USE_ESP_IDF
+
+FTPMutex::FTPMutex() { handle_ = xSemaphoreCreateMutex(); }
+
+FTPMutex::~FTPMutex() {
+  if (handle_ != nullptr) {
+    vSemaphoreDelete(handle_);
+  }
+}
+
+void FTPMutex::lock() { xSemaphoreTake(handle_, portMAX_DELAY); }
+void FTPMutex::unlock() { xSemaphoreGive(handle_); }
+
+static TickType_t to_ticks(uint32_t timeout_ms) {
+  return timeout_ms == FTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+}
+
+bool FTPTask::start(void (*entry)(void *), void *arg, const char *name, uint32_t stack, int priority, int core) {
+  BaseType_t affinity = core < 0 ? tskNO_AFFINITY : core;
+  running_ = xTaskCreatePinnedToCore(entry, name, stack, arg, priority, &handle_, affinity) == pdPASS;
+  if (!running_) {
+    handle_ = nullptr;
+  }
+  return running_;
+}
+
+void FTPTask::notify() {
+  if (handle_ != nullptr) {
+    xTaskNotifyGive(handle_);
+  }
+}
+
+void FTPTask::wait(uint32_t timeout_ms) { ulTaskNotifyTake(pdTRUE, to_ticks(timeout_ms)); }
+
+bool FTPJobQueue::create(size_t capacity) {
+  handle_ = xQueueCreate(capacity, sizeof(void *));
+  created_ = handle_ != nullptr;
+  return created_;
+}
+
+void FTPJobQueue::destroy() {
+  if (handle_ != nullptr) {
+    vQueueDelete(handle_);
+    handle_ = nullptr;
+  }
+  created_ = false;
+}
+
+bool FTPJobQueue::send(void *job) { return xQueueSend(handle_, &job, 0) == pdTRUE; }
+
+bool FTPJobQueue::receive(void *&job, uint32_t timeout_ms) {
+  return xQueueReceive(handle_, &job, to_ticks(timeout_ms)) == pdTRUE;
+}
+
+#else
+
+FTPMutex::FTPMutex() {}
+FTPMutex::~FTPMutex() {}
+void FTPMutex::lock() { mutex_.lock(); }
+void FTPMutex::unlock() { mutex_.unlock(); }
+
+bool FTPTask::start(void (*entry)(void *), void *arg, const char *, uint32_t, int, int) {
+  // Comme une tâche FreeRTOS de ce composant, le thread vit jusqu'à la fin du programme
+  std::thread(entry, arg).detach();
+  running_ = true;
+  return true;
+}
+
+void FTPTask::notify() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  notified_ = true;
+  wake_.notify_one();
+}
+
+void FTPTask::wait(uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (timeout_ms == FTP_WAIT_FOREVER) {
+    wake_.wait(guard, [this]() { return notified_; });
+  } else {
+    wake_.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this]() { return notified_; });
+  }
+  notified_ = false;
+}
+
+bool FTPJobQueue::create(size_t capacity) {
+  capacity_ = capacity;
+  created_ = true;
+  return true;
+}
+
+void FTPJobQueue::destroy() { created_ = false; }
+
+bool FTPJobQueue::send(void *job) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (jobs_.size() >= capacity_) {
+    return false;
+  }
+  jobs_.push_back(job);
+  ready_.notify_one();
+  return true;
+}
+
+bool FTPJobQueue::receive(void *&job, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  auto has_job = [this]() { return !jobs_.empty(); };
+  if (timeout_ms == FTP_WAIT_FOREVER) {
+    ready_.wait(guard, has_job);
+  } else if (!ready_.wait_for(guard, std::chrono::milliseconds(timeout_ms), has_job)) {
+    return false;
+  }
+  job = jobs_.front();
+  jobs_.pop_front();
+  return true;
+}
+
+#endif
+
+}  // namespace ftp_server
+}  // namespace esphome
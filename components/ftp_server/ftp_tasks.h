@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef USE_ESP_IDF
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#else
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#endif
+
+namespace esphome {
+namespace ftp_server {
+
+// Tâches, verrous et file de la tâche de lecture et des tâches de travail : FreeRTOS sur
+// ESP-IDF, threads POSIX sur la plateforme host pour exécuter et mesurer le même
+// ordonnancement sur un PC.
+
+static const uint32_t FTP_WAIT_FOREVER = UINT32_MAX;
+
+class FTPMutex {
+ public:
+  FTPMutex();
+  ~FTPMutex();
+  void lock();
+  void unlock();
+
+ protected:
+#ifdef USE_ESP_IDF
+  SemaphoreHandle_t handle_{nullptr};
+#else
+  std::mutex mutex_;
+#endif
+};
+
+// Tâche de fond qui ne se termine jamais, réveillable par notify()
+class FTPTask {
+ public:
+  // core -1 : pas d'affinité ; priorité et cœur sont ignorés sur host
+  bool start(void (*entry)(void *), void *arg, const char *name, uint32_t stack, int priority, int core);
+  bool is_running() const { return running_; }
+  void notify();
+  // Depuis la tâche elle-même : attend une notification au plus timeout_ms
+  void wait(uint32_t timeout_ms);
+
+ protected:
+  bool running_{false};
+#ifdef USE_ESP_IDF
+  TaskHandle_t handle_{nullptr};
+#else
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool notified_{false};
+#endif
+};
+
+// File bornée de pointeurs, d'une tâche à l'autre
+class FTPJobQueue {
+ public:
+  ~FTPJobQueue() { this->destroy(); }
+  bool create(size_t capacity);
+  void destroy();
+  bool is_created() const { return created_; }
+  // Sans attente : faux si la file est pleine
+  bool send(void *job);
+  // Faux si rien n'est arrivé avant timeout_ms
+  bool receive(void *&job, uint32_t timeout_ms);
+
+ protected:
+  bool created_{false};
+#ifdef USE_ESP_IDF
+  QueueHandle_t handle_{nullptr};
+#else
+  size_t capacity_{0};
+  std::deque<void *> jobs_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+#endif
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+namespace esphome {
+namespace ftp_server {
+
+enum FTPTraceType : uint8_t {
+  FTP_TRACE_CONNECT,
+  FTP_TRACE_DISCONNECT,
+  FTP_TRACE_COMMAND,         // verb : verbe encodé comme dans la table des commandes
+  FTP_TRACE_REPLY,           // status : code de réponse
+  FTP_TRACE_TRANSFER_BEGIN,  // status : FTPTransferKind
+  FTP_TRACE_TRANSFER_END,    // status : code final, bytes : octets transférés
+};
+
+// Événement binaire de taille fixe : rien n'est formaté au moment de l'enregistrement
+struct FTPTraceEvent {
+  uint32_t timestamp_us;
+  uint32_t bytes;
+  uint64_t verb;
+  uint16_t status;
+  uint8_t session;
+  FTPTraceType type;
+};
+
+// Anneau d'événements sans verrou, alimenté par loop() et par les tâches de transfert.
+// Chaque écrivain réserve une case avec un fetch_add puis la publie par son numéro de
+// séquence ; le lecteur ignore les cases en cours d'écriture ou réécrites pendant la copie.
+// Les événements les plus anciens sont écrasés quand l'anneau est plein.
+class FTPTrace {
+ public:
+  ~FTPTrace() { free(slots_); }
+
+  // capacity : puissance de deux ; une seule allocation, au démarrage
+  bool allocate(size_t capacity) {
+    slots_ = static_cast<Slot *>(calloc(capacity, sizeof(Slot)));
+    mask_ = slots_ != nullptr ? capacity - 1 : 0;
+    return slots_ != nullptr;
+  }
+  size_t capacity() const { return slots_ != nullptr ? mask_ + 1 : 0; }
+
+  void record(FTPTraceType type, uint8_t session, uint32_t timestamp_us, uint64_t verb = 0, uint16_t status = 0,
+              uint32_t bytes = 0) {
+    if (slots_ == nullptr) {
+      return;
+    }
+    uint32_t ticket = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots_[ticket & mask_];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = FTPTraceEvent{timestamp_us, bytes, verb, status, session, type};
+    slot.sequence.store(ticket + 1, std::memory_order_release);
+  }
+
+  // Parcourt les événements du plus ancien au plus récent ; retourne le nombre lu
+  template<typename F> size_t for_each(F &&callback) const {
+    if (slots_ == nullptr) {
+      return 0;
+    }
+    uint32_t head = head_.load(std::memory_order_acquire);
+    uint32_t first = head > mask_ + 1 ? head - (mask_ + 1) : 0;
+    size_t count = 0;
+    for (uint32_t ticket = first; ticket != head; ticket++) {
+      const Slot &slot = slots_[ticket & mask_];
+      if (slot.sequence.load(std::memory_order_acquire) != ticket + 1) {
+        continue;
+      }
+      FTPTraceEvent event = slot.event;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != ticket + 1) {
+        continue;
+      }
+      callback(event);
+      count++;
+    }
+    return count;
+  }
+
+ protected:
+  struct Slot {
+    std::atomic<uint32_t> sequence;  // ticket + 1 une fois l'événement publié, 0 pendant l'écriture
+    FTPTraceEvent event;
+  };
+
+  Slot *slots_{nullptr};
+  uint32_t mask_{0};
+  std::atomic<uint32_t> head_{0};
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace esphome {
+namespace ftp_server {
+
+// Cache LRU des listings déjà rendus (LIST/NLST/MLSD), indexé par répertoire et par type.
+// La mémoire occupée est bornée par capacity_ ; les entrées sont partagées pour qu'une
+// éviction pendant un envoi ne libère pas les données encore en cours de transmission.
+class ListingCache {
+ public:
+  using Listing = std::shared_ptr<const std::string>;
+
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    this->trim_(0);
+  }
+  size_t get_capacity() const { return capacity_; }
+  size_t get_used() const { return used_; }
+  bool is_enabled() const { return capacity_ > 0; }
+
+  // Incrémentée à chaque invalidation : un listing commencé avant une écriture n'est pas mis en cache
+  uint32_t get_generation() const { return generation_; }
+
+  Listing find(uint8_t kind, const std::string &path) {
+    std::string key = directory_key(path);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->kind == kind && it->path == key) {
+        entries_.splice(entries_.begin(), entries_, it);
+        return entries_.front().data;
+      }
+    }
+    return nullptr;
+  }
+
+  void insert(uint8_t kind, const std::string &path, std::string &&data, uint32_t generation) {
+    if (generation != generation_ || data.size() > capacity_) {
+      return;
+    }
+    std::string key = directory_key(path);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->kind == kind && it->path == key) {
+        used_ -= it->data->size();
+        entries_.erase(it);
+        break;
+      }
+    }
+    this->trim_(data.size());
+    used_ += data.size();
+    entries_.push_front(Entry{kind, std::move(key), std::make_shared<const std::string>(std::move(data))});
+  }
+
+  // Une modification de path invalide son répertoire parent, ainsi que path lui-même et
+  // tout ce qu'il contient s'il s'agit d'un répertoire (RMD, RNFR d'un dossier)
+  void invalidate(const std::string &path) {
+    generation_++;
+    std::string key = directory_key(path);
+    std::string parent = parent_key(key);
+    std::string prefix = key == "/" ? key : key + "/";
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (it->path == parent || it->path == key || it->path.compare(0, prefix.length(), prefix) == 0) {
+        used_ -= it->data->size();
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void clear() {
+    generation_++;
+    entries_.clear();
+    used_ = 0;
+  }
+
+  // "/sdcard/dir/" et "/sdcard/dir" désignent la même entrée
+  static std::string directory_key(const std::string &path) {
+    size_t end = path.find_last_not_of('/');
+    if (end == std::string::npos) {
+      return "/";
+    }
+    return path.substr(0, end + 1);
+  }
+
+ protected:
+  struct Entry {
+    uint8_t kind;
+    std::string path;
+    Listing data;
+  };
+
+  static std::string parent_key(const std::string &key) {
+    size_t slash = key.rfind('/');
+    if (slash == std::string::npos || slash == 0) {
+      return "/";
+    }
+    return key.substr(0, slash);
+  }
+
+  // Évince les entrées les moins récemment servies jusqu'à pouvoir accueillir incoming octets
+  void trim_(size_t incoming) {
+    while (!entries_.empty() && used_ + incoming > capacity_) {
+      used_ -= entries_.back().data->size();
+      entries_.pop_back();
+    }
+  }
+
+  std::list<Entry> entries_;
+  size_t capacity_{0};
+  size_t used_{0};
+  uint32_t generation_{0};
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
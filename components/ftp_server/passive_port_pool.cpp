@@ -0,0 +1,111 @@
+#include "passive_port_pool.h"
+#include "ftp_platform.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace esphome {
+namespace ftp_server {
+
+static const char *TAG = "ftp_server";
+
+size_t PassivePortPool::open(uint16_t first, uint16_t last) {
+  this->close_all();
+  for (uint32_t port = first; port <= last && count_ < MAX_PORTS; port++) {
+    slots_[count_].port = port;
+    slots_[count_].socket = listen_on(port);
+    slots_[count_].in_use = false;
+    count_++;
+  }
+  size_t listening = 0;
+  for (size_t i = 0; i < count_; i++) {
+    if (slots_[i].socket >= 0) {
+      listening++;
+    }
+  }
+  return listening;
+}
+
+void PassivePortPool::close_all() {
+  for (size_t i = 0; i < count_; i++) {
+    if (slots_[i].socket >= 0) {
+      close(slots_[i].socket);
+    }
+    slots_[i] = Slot{};
+  }
+  count_ = 0;
+  next_ = 0;
+}
+
+int PassivePortPool::acquire(uint16_t &port) {
+  for (size_t n = 0; n < count_; n++) {
+    Slot &slot = slots_[(next_ + n) % count_];
+    if (slot.in_use) {
+      continue;
+    }
+    // Un port dont l'ouverture a échoué au démarrage (réseau absent) est retenté ici
+    if (slot.socket < 0) {
+      slot.socket = listen_on(slot.port);
+      if (slot.socket < 0) {
+        continue;
+      }
+    }
+    // Connexions restées dans la file d'attente après le transfert précédent
+    drain(slot.socket);
+    slot.in_use = true;
+    next_ = (next_ + n + 1) % count_;
+    port = slot.port;
+    return slot.socket;
+  }
+  return -1;
+}
+
+bool PassivePortPool::release(int socket) {
+  for (size_t i = 0; i < count_; i++) {
+    if (slots_[i].socket == socket) {
+      slots_[i].in_use = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+int PassivePortPool::listen_on(uint16_t port) {
+  int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Failed to create passive data socket (errno: %d)", errno);
+    return -1;
+  }
+
+  int opt = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  struct sockaddr_in data_addr;
+  memset(&data_addr, 0, sizeof(data_addr));
+  data_addr.sin_family = AF_INET;
+  data_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  data_addr.sin_port = htons(port);
+  if (bind(sock, (struct sockaddr *)&data_addr, sizeof(data_addr)) < 0 || listen(sock, 1) < 0) {
+    ESP_LOGE(TAG, "Failed to listen on passive port %u (errno: %d)", port, errno);
+    close(sock);
+    return -1;
+  }
+
+  // Non bloquant : la purge des connexions orphelines ne doit jamais attendre
+  int flags = fcntl(sock, F_GETFL, 0);
+  fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+  return sock;
+}
+
+void PassivePortPool::drain(int socket) {
+  int stale;
+  while ((stale = accept(socket, nullptr, nullptr)) >= 0) {
+    close(stale);
+  }
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ftp_server {
+
+// Sockets d'écoute pré-ouverts sur une plage de ports passifs. Un PASV/EPSV emprunte un
+// port déjà en écoute au lieu de créer, lier et mettre en écoute un socket, et le rend
+// après le transfert sans le fermer. Utilisé uniquement depuis loop().
+class PassivePortPool {
+ public:
+  // Chaque port consomme un socket lwIP en permanence (CONFIG_LWIP_MAX_SOCKETS)
+  static const size_t MAX_PORTS = 16;
+
+  ~PassivePortPool() { this->close_all(); }
+
+  // Ouvre les ports [first, last] ; retourne le nombre de ports en écoute
+  size_t open(uint16_t first, uint16_t last);
+  void close_all();
+
+  bool is_enabled() const { return count_ > 0; }
+  size_t size() const { return count_; }
+  uint16_t first_port() const { return count_ > 0 ? slots_[0].port : 0; }
+  uint16_t last_port() const { return count_ > 0 ? slots_[count_ - 1].port : 0; }
+
+  // Emprunte un port libre ; -1 si tous sont pris
+  int acquire(uint16_t &port);
+  // Rend un socket emprunté ; faux s'il n'appartient pas au pool (écoute éphémère)
+  bool release(int socket);
+
+ protected:
+  struct Slot {
+    int socket{-1};
+    uint16_t port{0};
+    bool in_use{false};
+  };
+
+  static int listen_on(uint16_t port);
+  static void drain(int socket);
+
+  Slot slots_[MAX_PORTS];
+  size_t count_{0};
+  size_t next_{0};  // tourniquet : un port rendu n'est pas réattribué immédiatement
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,67 @@
+#include "path_resolver.h"
+#include <cstring>
+
+namespace esphome {
+namespace ftp_server {
+
+bool PathResolver::resolve(std::string_view current, std::string_view request, std::string_view &resolved) {
+  root_length_ = root_.size() - 1;
+  if (root_length_ >= MAX_PATH) {
+    return false;
+  }
+  memcpy(buffer_, root_.data(), root_length_);
+  length_ = root_length_;
+
+  // Un chemin absolu part de la racine, un chemin relatif du répertoire courant
+  if (request.empty() || request[0] != '/') {
+    if (current.size() > root_length_ && current.compare(0, root_length_, root_.data(), root_length_) == 0 &&
+        !push_segments_(current.substr(root_length_))) {
+      return false;
+    }
+  }
+  if (!push_segments_(request)) {
+    return false;
+  }
+
+  if (length_ == root_length_) {
+    buffer_[length_++] = '/';
+  }
+  resolved = std::string_view(buffer_, length_);
+  return true;
+}
+
+bool PathResolver::push_segments_(std::string_view path) {
+  size_t pos = 0;
+  while (pos < path.size()) {
+    size_t end = path.find('/', pos);
+    if (end == std::string_view::npos) {
+      end = path.size();
+    }
+    std::string_view segment = path.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (segment.empty() || segment == ".") {
+      continue;
+    }
+    if (segment == "..") {
+      // Au plus jusqu'à la racine : "/../x" désigne "/x", comme dans un chroot
+      while (length_ > root_length_ && buffer_[length_ - 1] != '/') {
+        length_--;
+      }
+      if (length_ > root_length_) {
+        length_--;
+      }
+      continue;
+    }
+    if (length_ + 1 + segment.size() > MAX_PATH) {
+      return false;
+    }
+    buffer_[length_++] = '/';
+    memcpy(buffer_ + length_, segment.data(), segment.size());
+    length_ += segment.size();
+  }
+  return true;
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
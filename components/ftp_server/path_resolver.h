@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace esphome {
+namespace ftp_server {
+
+// Résolution des chemins envoyés par les clients. Le client voit la racine du serveur
+// comme "/" : les segments de son répertoire courant puis ceux de la requête sont
+// empilés dans un tampon fixe, "." est ignoré et ".." dépile sans jamais remonter
+// au-dessus de la racine. Aucune allocation : le résultat pointe dans le tampon et
+// reste valable jusqu'à la résolution suivante. Utilisé uniquement depuis loop().
+class PathResolver {
+ public:
+  // Chemin complet (racine comprise) le plus long accepté
+  static const size_t MAX_PATH = 640;
+
+  // root : chemin absolu terminé par '/', comme root_path_
+  void set_root(const std::string &root) { root_ = root; }
+
+  // current : répertoire courant déjà résolu (sous la racine), request : chemin du client.
+  // La racine elle-même est rendue avec son '/' final, les autres chemins sans.
+  // Retourne faux si le résultat dépasse MAX_PATH.
+  bool resolve(std::string_view current, std::string_view request, std::string_view &resolved);
+
+ protected:
+  bool push_segments_(std::string_view path);
+
+  std::string root_;
+  char buffer_[MAX_PATH];
+  size_t length_{0};
+  size_t root_length_{0};  // longueur de la racine sans son '/' final
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
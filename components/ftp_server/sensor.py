@@ -0,0 +1,81 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_BYTES,
+    UNIT_MILLISECOND,
+    ICON_TIMER,
+)
+from . import FTPServer, CONF_FTP_SERVER_ID
+
+DEPENDENCIES = ["ftp_server"]
+
+CONF_ACTIVE_SESSIONS = "active_sessions"
+CONF_ACTIVE_TRANSFERS = "active_transfers"
+CONF_SEND_RATE = "send_rate"
+CONF_RECEIVE_RATE = "receive_rate"
+CONF_BYTES_SENT = "bytes_sent"
+CONF_BYTES_RECEIVED = "bytes_received"
+CONF_DATA_CONNECTION_FAILURES = "data_connection_failures"
+CONF_TTFB_P50 = "ttfb_p50"
+CONF_TTFB_P99 = "ttfb_p99"
+
+UNIT_BYTES_PER_SECOND = "B/s"
+
+COUNT_SCHEMA = sensor.sensor_schema(
+    icon="mdi:connection",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+RATE_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES_PER_SECOND,
+    icon="mdi:swap-vertical",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+TOTAL_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    icon="mdi:counter",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+)
+TTFB_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    icon=ICON_TIMER,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+
+SENSORS = {
+    CONF_ACTIVE_SESSIONS: COUNT_SCHEMA,
+    CONF_ACTIVE_TRANSFERS: COUNT_SCHEMA,
+    CONF_SEND_RATE: RATE_SCHEMA,
+    CONF_RECEIVE_RATE: RATE_SCHEMA,
+    CONF_BYTES_SENT: TOTAL_SCHEMA,
+    CONF_BYTES_RECEIVED: TOTAL_SCHEMA,
+    CONF_DATA_CONNECTION_FAILURES: sensor.sensor_schema(
+        icon="mdi:lan-disconnect",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+    ),
+    CONF_TTFB_P50: TTFB_SCHEMA,
+    CONF_TTFB_P99: TTFB_SCHEMA,
+}
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_FTP_SERVER_ID): cv.use_id(FTPServer),
+        **{cv.Optional(key): schema for key, schema in SENSORS.items()},
+    }
+)
+
+
+async def to_code(config):
+    ftp_server_component = await cg.get_variable(config[CONF_FTP_SERVER_ID])
+    for key in SENSORS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            func = getattr(ftp_server_component, f"set_{key}_sensor")
+            cg.add(func(sens))
@@ -0,0 +1,25 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import text_sensor
+from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
+)
+from . import FTPServer, CONF_FTP_SERVER_ID
+
+DEPENDENCIES = ["ftp_server"]
+
+CONF_LAST_TRANSFER = "last_transfer"
+
+CONFIG_SCHEMA = {
+    cv.GenerateID(CONF_FTP_SERVER_ID): cv.use_id(FTPServer),
+    cv.Optional(CONF_LAST_TRANSFER): text_sensor.text_sensor_schema(
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+    ),
+}
+
+async def to_code(config):
+    ftp_server_component = await cg.get_variable(config[CONF_FTP_SERVER_ID])
+
+    if CONF_LAST_TRANSFER in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_LAST_TRANSFER])
+        cg.add(ftp_server_component.set_last_transfer_text_sensor(sens))
@@ -0,0 +1,90 @@
+#include "upload_sink.h"
+#include "ftp_platform.h"
+#include <unistd.h>
+#include <errno.h>
+
+namespace esphome {
+namespace ftp_server {
+
+static const char *TAG = "ftp_upload";
+
+void UploadSink::begin(int fd, char *buffer, size_t capacity, uint64_t offset) {
+  fd_ = fd;
+  buffer_ = buffer;
+  capacity_ = capacity;
+  len_ = 0;
+  position_ = offset;
+  preallocated_ = false;
+  error_ = 0;
+  // Un tampon plus petit qu'un cluster (repli sans PSRAM) écrit sans chercher l'alignement
+  limit_ = capacity;
+  if (capacity == FTP_UPLOAD_CLUSTER_SIZE) {
+    limit_ = capacity - offset % capacity;
+  }
+}
+
+bool UploadSink::commit(size_t len) {
+  len_ += len;
+  if (len_ < limit_) {
+    return true;
+  }
+  return this->write_out_();
+}
+
+bool UploadSink::flush() {
+  if (len_ == 0) {
+    return true;
+  }
+  return this->write_out_();
+}
+
+bool UploadSink::write_out_() {
+  size_t written = 0;
+  while (written < len_) {
+    ssize_t count = write(fd_, buffer_ + written, len_ - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      // FatFS renvoie une écriture tronquée quand la carte est pleine
+      error_ = count < 0 ? errno : ENOSPC;
+      break;
+    }
+    written += count;
+  }
+  // Le reste est abandonné en cas d'erreur : un nouvel appel ne doit pas réécrire les mêmes octets
+  position_ += written;
+  len_ = 0;
+  limit_ = capacity_;
+  return error_ == 0;
+}
+
+bool UploadSink::preallocate(uint64_t size) {
+  if (size == 0) {
+    return true;
+  }
+  if (ftruncate(fd_, position_ + size) != 0) {
+    if (errno == ENOSPC) {
+      error_ = ENOSPC;
+      return false;
+    }
+    // Extension non supportée par le système de fichiers : on continue sans réservation
+    ESP_LOGD(TAG, "Preallocation of %llu bytes not possible (errno: %d)", (unsigned long long) size, errno);
+    return true;
+  }
+  preallocated_ = true;
+  return true;
+}
+
+bool UploadSink::finish() {
+  bool ok = this->flush();
+  if (preallocated_ && ftruncate(fd_, position_) != 0) {
+    ESP_LOGW(TAG, "Failed to trim preallocated file to %llu bytes (errno: %d)", (unsigned long long) position_,
+             errno);
+  }
+  preallocated_ = false;
+  return ok;
+}
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace ftp_server {
+
+// Taille d'écriture visée pour les STOR : l'allocation_unit_size utilisée par SdMmc au montage
+static const size_t FTP_UPLOAD_CLUSTER_SIZE = 64 * 1024;
+
+// Regroupe les données reçues en écritures alignées sur les clusters FAT.
+// recv() remplit directement le tampon (tail()/space()), commit() déclenche l'écriture
+// dès qu'une frontière de cluster est atteinte dans le fichier.
+class UploadSink {
+ public:
+  // offset est la position d'écriture dans le fichier : le premier bloc est raccourci
+  // pour que les suivants tombent sur une frontière de cluster
+  void begin(int fd, char *buffer, size_t capacity, uint64_t offset);
+
+  char *tail() { return buffer_ + len_; }
+  size_t space() const { return limit_ - len_; }
+
+  bool commit(size_t len);
+  bool flush();
+
+  // Réserve size octets au-delà de offset pour obtenir une chaîne de clusters contiguë ;
+  // finish() retire ensuite ce qui n'a pas été écrit
+  bool preallocate(uint64_t size);
+  bool finish();
+
+  // errno de la dernière écriture ratée, ENOSPC pour une écriture tronquée
+  int get_error() const { return error_; }
+
+ protected:
+  bool write_out_();
+
+  int fd_{-1};
+  char *buffer_{nullptr};
+  size_t capacity_{0};
+  size_t len_{0};
+  size_t limit_{0};
+  uint64_t position_{0};
+  bool preallocated_{false};
+  int error_{0};
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
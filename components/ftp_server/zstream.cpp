@@ -0,0 +1,248 @@
+#include "zstream.h"
+#include "ftp_platform.h"
+
+namespace esphome {
+namespace ftp_server {
+
+size_t ZStream::end() {
+  if (state_ != nullptr) {
+#ifdef USE_HOST
+    if (compress_) {
+      deflateEnd(static_cast<z_stream *>(state_));
+    } else {
+      inflateEnd(static_cast<z_stream *>(state_));
+    }
+#endif
+    heap_caps_free(state_);
+  }
+  if (in_ != nullptr) {
+    heap_caps_free(in_);
+  }
+  if (out_ != nullptr) {
+    heap_caps_free(out_);
+  }
+  state_ = nullptr;
+  in_ = nullptr;
+  out_ = nullptr;
+  done_ = false;
+  in_pos_ = in_len_ = 0;
+  out_pos_ = out_len_ = 0;
+  dict_pos_ = 0;
+  size_t released = allocated_;
+  allocated_ = 0;
+  return released;
+}
+
+const char *ZStream::pending(size_t &len) const {
+  if (out_pos_ >= out_len_) {
+    return nullptr;
+  }
+  len = out_len_ - out_pos_;
+  return out_ + out_pos_;
+}
+
+static void *allocate(size_t size) {
+  void *buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  if (buffer == nullptr) {
+    buffer = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+  return buffer;
+}
+
+#ifdef USE_HOST
+// Même contrat que la version miniz : la sortie tient dans out_ (IO_SIZE octets) et doit
+// être consommée avant l'appel suivant ; zlib garde sa propre fenêtre de décompression
+
+bool ZStream::begin_deflate(int level) {
+  this->end();
+  z_stream *z = static_cast<z_stream *>(allocate(sizeof(z_stream)));
+  out_ = static_cast<char *>(allocate(IO_SIZE));
+  if (z == nullptr || out_ == nullptr) {
+    heap_caps_free(z);
+    this->end();
+    return false;
+  }
+  *z = z_stream{};
+  if (level < 1 || level > 9) {
+    level = 6;
+  }
+  if (deflateInit(z, level) != Z_OK) {
+    heap_caps_free(z);
+    this->end();
+    return false;
+  }
+  state_ = z;
+  compress_ = true;
+  allocated_ = deflate_memory();
+  return true;
+}
+
+bool ZStream::begin_inflate() {
+  this->end();
+  z_stream *z = static_cast<z_stream *>(allocate(sizeof(z_stream)));
+  in_ = static_cast<char *>(allocate(IO_SIZE));
+  out_ = static_cast<char *>(allocate(IO_SIZE));
+  if (z == nullptr || in_ == nullptr || out_ == nullptr) {
+    heap_caps_free(z);
+    this->end();
+    return false;
+  }
+  *z = z_stream{};
+  if (inflateInit(z) != Z_OK) {
+    heap_caps_free(z);
+    this->end();
+    return false;
+  }
+  state_ = z;
+  compress_ = false;
+  allocated_ = inflate_memory();
+  return true;
+}
+
+bool ZStream::deflate(const char *data, size_t len, size_t &consumed) {
+  z_stream *z = static_cast<z_stream *>(state_);
+  z->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  z->avail_in = len;
+  z->next_out = reinterpret_cast<Bytef *>(out_);
+  z->avail_out = IO_SIZE;
+  int status = ::deflate(z, Z_NO_FLUSH);
+  consumed = len - z->avail_in;
+  out_pos_ = 0;
+  out_len_ = IO_SIZE - z->avail_out;
+  // Z_BUF_ERROR : aucune progression possible, pas une erreur
+  return status == Z_OK || status == Z_BUF_ERROR;
+}
+
+bool ZStream::finish_deflate() {
+  z_stream *z = static_cast<z_stream *>(state_);
+  z->next_in = nullptr;
+  z->avail_in = 0;
+  z->next_out = reinterpret_cast<Bytef *>(out_);
+  z->avail_out = IO_SIZE;
+  int status = ::deflate(z, Z_FINISH);
+  out_pos_ = 0;
+  out_len_ = IO_SIZE - z->avail_out;
+  if (status == Z_STREAM_END) {
+    done_ = true;
+  }
+  return status == Z_OK || status == Z_STREAM_END || status == Z_BUF_ERROR;
+}
+
+bool ZStream::inflate() {
+  if (done_) {
+    // Octets après la fin du flux : ignorés
+    in_pos_ = in_len_ = 0;
+    return true;
+  }
+  z_stream *z = static_cast<z_stream *>(state_);
+  z->next_in = reinterpret_cast<Bytef *>(in_ + in_pos_);
+  z->avail_in = in_len_ - in_pos_;
+  z->next_out = reinterpret_cast<Bytef *>(out_);
+  z->avail_out = IO_SIZE;
+  int status = ::inflate(z, Z_NO_FLUSH);
+  in_pos_ = in_len_ - z->avail_in;
+  if (in_pos_ == in_len_) {
+    in_pos_ = in_len_ = 0;
+  }
+  out_pos_ = 0;
+  out_len_ = IO_SIZE - z->avail_out;
+  if (status == Z_STREAM_END) {
+    done_ = true;
+  }
+  return status == Z_OK || status == Z_STREAM_END || status == Z_BUF_ERROR;
+}
+#else
+
+// Nombre de sondes par niveau, repris de miniz (tdefl_create_comp_flags_from_zip_params)
+static const uint32_t NUM_PROBES[11] = {0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500};
+
+bool ZStream::begin_deflate(int level) {
+  this->end();
+  state_ = allocate(sizeof(tdefl_compressor));
+  out_ = static_cast<char *>(allocate(IO_SIZE));
+  if (state_ == nullptr || out_ == nullptr) {
+    this->end();
+    return false;
+  }
+  if (level < 0 || level > 10) {
+    level = 6;
+  }
+  int flags = NUM_PROBES[level] | TDEFL_WRITE_ZLIB_HEADER;
+  if (level <= 3) {
+    flags |= TDEFL_GREEDY_PARSING_FLAG;
+  }
+  tdefl_init(static_cast<tdefl_compressor *>(state_), nullptr, nullptr, flags);
+  compress_ = true;
+  allocated_ = deflate_memory();
+  return true;
+}
+
+bool ZStream::begin_inflate() {
+  this->end();
+  state_ = allocate(sizeof(tinfl_decompressor));
+  in_ = static_cast<char *>(allocate(IO_SIZE));
+  out_ = static_cast<char *>(allocate(TINFL_LZ_DICT_SIZE));
+  if (state_ == nullptr || in_ == nullptr || out_ == nullptr) {
+    this->end();
+    return false;
+  }
+  tinfl_init(static_cast<tinfl_decompressor *>(state_));
+  compress_ = false;
+  allocated_ = inflate_memory();
+  return true;
+}
+
+bool ZStream::deflate(const char *data, size_t len, size_t &consumed) {
+  // Appelé uniquement quand la sortie précédente a été envoyée
+  size_t out_size = IO_SIZE;
+  consumed = len;
+  tdefl_status status =
+      tdefl_compress(static_cast<tdefl_compressor *>(state_), data, &consumed, out_, &out_size, TDEFL_NO_FLUSH);
+  out_pos_ = 0;
+  out_len_ = out_size;
+  return status >= TDEFL_STATUS_OKAY;
+}
+
+bool ZStream::finish_deflate() {
+  size_t in_size = 0;
+  size_t out_size = IO_SIZE;
+  tdefl_status status =
+      tdefl_compress(static_cast<tdefl_compressor *>(state_), nullptr, &in_size, out_, &out_size, TDEFL_FINISH);
+  out_pos_ = 0;
+  out_len_ = out_size;
+  if (status == TDEFL_STATUS_DONE) {
+    done_ = true;
+  }
+  return status >= TDEFL_STATUS_OKAY;
+}
+
+bool ZStream::inflate() {
+  if (done_) {
+    // Octets après la fin du flux : ignorés
+    in_pos_ = in_len_ = 0;
+    return true;
+  }
+  // Le dictionnaire circulaire sert de tampon de sortie : la sortie précédente doit être consommée
+  size_t in_size = in_len_ - in_pos_;
+  size_t out_size = TINFL_LZ_DICT_SIZE - dict_pos_;
+  uint8_t *dict = reinterpret_cast<uint8_t *>(out_);
+  tinfl_status status = tinfl_decompress(static_cast<tinfl_decompressor *>(state_),
+                                         reinterpret_cast<const uint8_t *>(in_ + in_pos_), &in_size, dict,
+                                         dict + dict_pos_, &out_size,
+                                         TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+  in_pos_ += in_size;
+  if (in_pos_ == in_len_) {
+    in_pos_ = in_len_ = 0;
+  }
+  out_pos_ = dict_pos_;
+  out_len_ = dict_pos_ + out_size;
+  dict_pos_ = (dict_pos_ + out_size) & (TINFL_LZ_DICT_SIZE - 1);
+  if (status == TINFL_STATUS_DONE) {
+    done_ = true;
+  }
+  return status >= TINFL_STATUS_DONE;
+}
+#endif
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef USE_HOST
+#include <zlib.h>
+#else
+#include "rom/miniz.h"
+#endif
+
+namespace esphome {
+namespace ftp_server {
+
+// Flux zlib (RFC 1950) d'un transfert en MODE Z, basé sur le miniz de la ROM (sur la
+// plateforme host, sur la zlib du système).
+// Un même objet sert soit à compresser (RETR, listings), soit à décompresser (STOR/APPE) ;
+// la mémoire de travail est allouée par begin_*() et rendue par end().
+class ZStream {
+ public:
+  static const size_t IO_SIZE = 4096;
+
+  // Mémoire de travail de chaque sens, comptée dans le budget compression_memory
+#ifdef USE_HOST
+  // Allocations internes de zlib (zconf.h) pour windowBits 15 et memLevel 8, état compris
+  static size_t deflate_memory() { return sizeof(z_stream) + (1 << 17) + (1 << 17) + 6 * 1024 + IO_SIZE; }
+  static size_t inflate_memory() { return sizeof(z_stream) + (1 << 15) + 7 * 1024 + 2 * IO_SIZE; }
+#else
+  static size_t deflate_memory() { return sizeof(tdefl_compressor) + IO_SIZE; }
+  static size_t inflate_memory() { return sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE + IO_SIZE; }
+#endif
+
+  ~ZStream() { this->end(); }
+
+  bool begin_deflate(int level);
+  bool begin_inflate();
+  // Retourne la mémoire libérée
+  size_t end();
+  bool is_active() const { return state_ != nullptr; }
+  bool is_done() const { return done_ && out_pos_ == out_len_; }
+
+  // Compression : consomme au plus len octets ; la sortie est ensuite lue via pending()
+  bool deflate(const char *data, size_t len, size_t &consumed);
+  // Termine le flux ; à rappeler après avoir vidé pending() tant que is_done() est faux
+  bool finish_deflate();
+
+  // Décompression : les octets reçus sont déposés dans input_tail() puis inflate() remplit pending()
+  char *input_tail() { return in_ + in_len_; }
+  size_t input_space() const { return IO_SIZE - in_len_; }
+  void commit_input(size_t len) { in_len_ += len; }
+  bool has_input() const { return in_pos_ < in_len_; }
+  bool inflate();
+
+  // Sortie produite (compressée ou décompressée) pas encore envoyée/écrite
+  const char *pending(size_t &len) const;
+  void consume(size_t len) { out_pos_ += len; }
+
+ protected:
+  void *state_{nullptr};
+  bool compress_{false};
+  bool done_{false};
+  char *in_{nullptr};
+  size_t in_pos_{0};
+  size_t in_len_{0};
+  char *out_{nullptr};  // tampon de sortie (compression) ou dictionnaire circulaire (décompression)
+  size_t out_pos_{0};
+  size_t out_len_{0};
+  size_t dict_pos_{0};
+  size_t allocated_{0};
+};
+
+}  // namespace ftp_server
+}  // namespace esphome
@@ -180,6 +180,7 @@ void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, cons
     ESP_LOGE(TAG, "Failed to write to file");
   }
   fclose(file);
+  this->file_changed_callback_.call(absolut_path);
   this->update_sensors();
 }
 
@@ -203,6 +204,7 @@ void SdMmc::write_file_chunked(const char *path, const uint8_t *buffer, size_t l
     written += to_write;
   }
   fclose(file);
+  this->file_changed_callback_.call(absolut_path);
   this->update_sensors();
 }
 #else
@@ -348,6 +350,7 @@ bool SdMmc::create_directory(const char *path) {
     ESP_LOGE(TAG, "Failed to create a new directory: %s", strerror(errno));
     return false;
   }
+  this->file_changed_callback_.call(absolut_path);
   this->update_sensors();
   return true;
 }
@@ -362,6 +365,7 @@ bool SdMmc::remove_directory(const char *path) {
   if (remove(absolut_path.c_str()) != 0) {
     ESP_LOGE(TAG, "Failed to remove directory: %s", strerror(errno));
   }
+  this->file_changed_callback_.call(absolut_path);
   this->update_sensors();
   return true;
 }
@@ -376,6 +380,7 @@ bool SdMmc::delete_file(const char *path) {
   if (remove(absolut_path.c_str()) != 0) {
     ESP_LOGE(TAG, "Failed to remove file: %s", strerror(errno));
   }
+  this->file_changed_callback_.call(absolut_path);
   this->update_sensors();
   return true;
 }
@@ -3,6 +3,7 @@
 #include "esphome/core/defines.h"
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
 #ifdef USE_SENSOR
 #include "esphome/components/sensor/sensor.h"
 #endif
@@ -79,6 +80,10 @@ class SdMmc : public Component {
 #ifdef USE_SENSOR
   void add_file_size_sensor(sensor::Sensor *, std::string const &path);
 #endif
+  // Appelé avec le chemin absolu de chaque fichier ou dossier modifié
+  void add_on_file_changed_callback(std::function<void(const std::string &)> &&callback) {
+    this->file_changed_callback_.add(std::move(callback));
+  }
 
   void set_clk_pin(uint8_t);
   void set_cmd_pin(uint8_t);
@@ -106,6 +111,7 @@ class SdMmc : public Component {
 #ifdef USE_SENSOR
   std::vector<FileSizeSensor> file_size_sensors_{};
 #endif
+  CallbackManager<void(const std::string &)> file_changed_callback_;
   void update_sensors();
 
 #ifdef USE_ESP_IDF